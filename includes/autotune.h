@@ -0,0 +1,28 @@
+// Include guard
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+// Includes
+#include "tensor.h"
+
+// Environment variable naming the tuning file loaded at startup
+#define TENSOR_TUNING_FILE_ENV "TENSOR_TUNING_FILE"
+
+// Get a GEMM configuration derived from the cache sizes of this machine
+TensorGemmConfig
+tensor_autotune_heuristic(void);
+
+// Benchmark GEMM configurations, then apply and save the fastest one
+int
+tensor_autotune(const char* path, TensorGemmConfig* best);
+
+// Apply the GEMM configuration saved for this machine in a tuning file
+int
+tensor_autotune_load(const char* path);
+
+// Get the GEMM configuration to start with, tuned if a tuning file has one
+TensorGemmConfig
+tensor_autotune_startup_config(void);
+
+// End of include guard
+#endif
@@ -0,0 +1,55 @@
+// Include guard
+#ifndef COLLECTIVE_H
+#define COLLECTIVE_H
+
+// Includes
+#include "tensor.h"
+#include <stdint.h>
+
+// Group of processes on one machine exchanging tensors through shared memory
+typedef struct TensorCommunicator TensorCommunicator;
+
+// Join the communicator with the given shared memory name as one rank
+TensorCommunicator*
+tensor_comm_create(const char* name,
+                   uint64_t session,
+                   size_t rank,
+                   size_t world_size,
+                   size_t capacity);
+
+// Leave a communicator and unmap its shared memory
+void
+tensor_comm_free(TensorCommunicator* comm);
+
+// Get the rank of the calling process in a communicator
+size_t
+tensor_comm_rank(const TensorCommunicator* comm);
+
+// Get the number of processes in a communicator
+size_t
+tensor_comm_world_size(const TensorCommunicator* comm);
+
+// Wait until every rank has reached the barrier
+void
+tensor_comm_barrier(TensorCommunicator* comm);
+
+// Sum a tensor across all ranks in place
+int
+tensor_allreduce(TensorCommunicator* comm, Tensor* tensor);
+
+// Copy a tensor from the root rank to all other ranks in place
+int
+tensor_broadcast(TensorCommunicator* comm, Tensor* tensor, size_t root);
+
+// Sum a tensor across all ranks and keep this rank's equal share of the sum
+int
+tensor_reduce_scatter(TensorCommunicator* comm,
+                      const Tensor* input,
+                      Tensor* output);
+
+// Concatenate a tensor from every rank, in rank order, on all ranks
+int
+tensor_allgather(TensorCommunicator* comm, const Tensor* input, Tensor* output);
+
+// End of include guard
+#endif
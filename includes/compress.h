@@ -0,0 +1,65 @@
+// Include guard
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+// Includes
+#include "tensor.h"
+
+// Number of elements in each independently compressed block
+#define TENSOR_COMPRESS_BLOCK 4096
+
+// Tensor held as losslessly compressed blocks
+typedef struct TensorCompressed TensorCompressed;
+
+// Compress a tensor into independently decodable blocks
+TensorCompressed*
+tensor_compress(const Tensor* tensor);
+
+// Decompress a whole tensor
+Tensor*
+tensor_decompress(const TensorCompressed* compressed);
+
+// Free a compressed tensor
+void
+tensor_compressed_free(TensorCompressed* compressed);
+
+// Get the shape of a compressed tensor
+const size_t*
+tensor_compressed_shape(const TensorCompressed* compressed);
+
+// Get the number of dimensions of a compressed tensor
+size_t
+tensor_compressed_num_dims(const TensorCompressed* compressed);
+
+// Get the number of elements of a compressed tensor
+size_t
+tensor_compressed_num_elements(const TensorCompressed* compressed);
+
+// Get the number of bytes of compressed data
+size_t
+tensor_compressed_size(const TensorCompressed* compressed);
+
+// Get the number of blocks of a compressed tensor
+size_t
+tensor_compressed_num_blocks(const TensorCompressed* compressed);
+
+// Decode one block into a scratch buffer of TENSOR_COMPRESS_BLOCK elements
+size_t
+tensor_compressed_block(const TensorCompressed* compressed,
+                        size_t block,
+                        tensor_dtype* scratch);
+
+// Save a compressed tensor to a file
+int
+tensor_compressed_save(const TensorCompressed* compressed, const char* path);
+
+// Load a compressed tensor from a file
+TensorCompressed*
+tensor_compressed_load(const char* path);
+
+// Compute the sum along an axis, decoding one block at a time
+Tensor*
+tensor_compressed_sum(const TensorCompressed* compressed, size_t axis);
+
+// End of include guard
+#endif
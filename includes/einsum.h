@@ -0,0 +1,22 @@
+// Include guard
+#ifndef EINSUM_H
+#define EINSUM_H
+
+// Includes
+#include "tensor.h"
+
+// Maximum number of operands of an einsum
+#define TENSOR_EINSUM_MAX_OPERANDS 16
+
+// Compute an Einstein summation such as "ij,jk->ik" over the operands
+Tensor*
+tensor_einsum(const char* spec,
+              const Tensor* const* operands,
+              size_t num_operands);
+
+// Drop all cached einsum contraction plans
+void
+tensor_einsum_clear_cache(void);
+
+// End of include guard
+#endif
@@ -0,0 +1,44 @@
+// Include guard
+#ifndef INDEX_H
+#define INDEX_H
+
+// Includes
+#include "tensor.h"
+
+// Reduction applied to the embeddings of each bag of a lookup
+typedef enum
+{
+  TENSOR_EMBEDDING_SUM,
+  TENSOR_EMBEDDING_MEAN,
+  TENSOR_EMBEDDING_MAX
+} TensorEmbeddingMode;
+
+// Select slices of a tensor along an axis by index
+Tensor*
+tensor_index_select(const Tensor* tensor,
+                    size_t axis,
+                    const size_t* indices,
+                    size_t num_indices);
+
+// Gather elements along an axis at the positions given by an index tensor
+Tensor*
+tensor_gather(const Tensor* tensor, size_t axis, const Tensor* index);
+
+// Add source elements into a tensor along an axis at indexed positions
+int
+tensor_scatter_add(Tensor* tensor,
+                   size_t axis,
+                   const Tensor* index,
+                   const Tensor* source);
+
+// Look up bags of embedding columns and reduce each bag to one column
+Tensor*
+tensor_embedding_bag(const Tensor* weight,
+                     const size_t* indices,
+                     size_t num_indices,
+                     const size_t* offsets,
+                     size_t num_bags,
+                     TensorEmbeddingMode mode);
+
+// End of include guard
+#endif
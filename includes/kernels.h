@@ -0,0 +1,30 @@
+// Include guard
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// Includes
+#include "tensor.h"
+
+// Compute C = activation(A * B + bias) for column-major matrices, unchecked
+void
+tensor_gemm(size_t m,
+            size_t n,
+            size_t k,
+            const tensor_dtype* a,
+            const tensor_dtype* b,
+            tensor_dtype* c,
+            const tensor_dtype* bias,
+            TensorActivation activation);
+
+// Give a tensor its own storage if shared, copying the data if preserve is set
+int
+tensor_detach(Tensor* tensor, int preserve);
+
+// Apply an activation to a contiguous run of values in place
+void
+tensor_activate(tensor_dtype* values,
+                size_t count,
+                TensorActivation activation);
+
+// End of include guard
+#endif
@@ -0,0 +1,103 @@
+// Include guard
+#ifndef PLAN_H
+#define PLAN_H
+
+// Includes
+#include "tensor.h"
+
+// Handle returned in place of a value when capturing an operation fails
+#define TENSOR_PLAN_INVALID ((size_t)-1)
+
+// Fixed sequence of tensor operations compiled into one memory arena
+typedef struct TensorPlan TensorPlan;
+
+// Element-wise operations between two values of the same shape
+typedef enum
+{
+  TENSOR_PLAN_ADD,
+  TENSOR_PLAN_SUBTRACT,
+  TENSOR_PLAN_MULTIPLY,
+  TENSOR_PLAN_DIVIDE
+} TensorPlanBinary;
+
+// Reductions along an axis
+typedef enum
+{
+  TENSOR_PLAN_SUM,
+  TENSOR_PLAN_MEAN,
+  TENSOR_PLAN_MAX,
+  TENSOR_PLAN_MIN
+} TensorPlanReduce;
+
+// Create an empty plan
+TensorPlan*
+tensor_plan_create(void);
+
+// Free a plan, its arena and its outputs
+void
+tensor_plan_free(TensorPlan* plan);
+
+// Capture an input of a fixed shape, bound when the plan runs
+size_t
+tensor_plan_input(TensorPlan* plan, const size_t* shape, size_t num_dims);
+
+// Capture a matrix multiplication
+size_t
+tensor_plan_matmul(TensorPlan* plan, size_t value1, size_t value2);
+
+// Capture a dense layer, with bias TENSOR_PLAN_INVALID for none
+size_t
+tensor_plan_linear(TensorPlan* plan,
+                   size_t input,
+                   size_t weight,
+                   size_t bias,
+                   TensorActivation activation);
+
+// Capture an element-wise operation between two values
+size_t
+tensor_plan_binary(TensorPlan* plan,
+                   TensorPlanBinary op,
+                   size_t value1,
+                   size_t value2);
+
+// Capture an element-wise activation
+size_t
+tensor_plan_activation(TensorPlan* plan,
+                       size_t value,
+                       TensorActivation activation);
+
+// Capture a multiplication by a scalar
+size_t
+tensor_plan_scalar_multiply(TensorPlan* plan,
+                            size_t value,
+                            tensor_dtype scalar);
+
+// Capture a reduction along an axis
+size_t
+tensor_plan_reduce(TensorPlan* plan,
+                   TensorPlanReduce op,
+                   size_t value,
+                   size_t axis);
+
+// Mark a value as an output of the plan
+int
+tensor_plan_output(TensorPlan* plan, size_t value);
+
+// Plan the memory of the captured operations and allocate it
+int
+tensor_plan_compile(TensorPlan* plan);
+
+// Get the size of the arena holding the intermediates, in bytes
+size_t
+tensor_plan_arena_size(const TensorPlan* plan);
+
+// Run a compiled plan on inputs matching the captured shapes
+int
+tensor_plan_run(TensorPlan* plan, const Tensor* const* inputs);
+
+// Get an output of the last run, in the order the outputs were marked
+const Tensor*
+tensor_plan_result(const TensorPlan* plan, size_t index);
+
+// End of include guard
+#endif
@@ -0,0 +1,50 @@
+// Include guard
+#ifndef RANDOM_H
+#define RANDOM_H
+
+// Includes
+#include "tensor.h"
+#include <stdint.h>
+
+// Counter-based random number generator state
+typedef struct
+{
+  uint64_t seed;
+  uint64_t offset;
+} TensorGenerator;
+
+// Compute one Philox4x32-10 block from a counter and a key
+void
+tensor_philox(const uint32_t counter[4],
+              const uint32_t key[2],
+              uint32_t output[4]);
+
+// Initialize a generator from a seed
+void
+tensor_generator_init(TensorGenerator* generator, uint64_t seed);
+
+// Create a new tensor of uniform samples in [low, high)
+Tensor*
+tensor_random_uniform(TensorGenerator* generator,
+                      const size_t* shape,
+                      size_t num_dims,
+                      tensor_dtype low,
+                      tensor_dtype high);
+
+// Create a new tensor of normal samples with the given mean and deviation
+Tensor*
+tensor_random_normal(TensorGenerator* generator,
+                     const size_t* shape,
+                     size_t num_dims,
+                     tensor_dtype mean,
+                     tensor_dtype std);
+
+// Create a new tensor of Bernoulli samples that are 1 with probability p
+Tensor*
+tensor_random_bernoulli(TensorGenerator* generator,
+                        const size_t* shape,
+                        size_t num_dims,
+                        tensor_dtype p);
+
+// End of include guard
+#endif
@@ -0,0 +1,86 @@
+// Include guard
+#ifndef STREAM_H
+#define STREAM_H
+
+// Includes
+#include "tensor.h"
+
+// Maximum number of input futures of a stream operation
+#define TENSOR_STREAM_MAX_INPUTS 4
+
+// In-order queue of asynchronous tensor operations
+typedef struct TensorStream TensorStream;
+
+// Handle to the eventual result of an asynchronous tensor operation
+typedef struct TensorFuture TensorFuture;
+
+// Signatures of tensor operations that can be enqueued on a stream
+typedef Tensor* (*TensorUnaryOp)(const Tensor* tensor);
+typedef Tensor* (*TensorBinaryOp)(const Tensor* tensor1, const Tensor* tensor2);
+typedef Tensor* (*TensorAxisOp)(const Tensor* tensor, size_t axis);
+typedef Tensor* (*TensorScalarOp)(const Tensor* tensor, tensor_dtype scalar);
+typedef Tensor* (*TensorStreamOp)(const Tensor* const* inputs, void* arg);
+
+// Create a new stream
+TensorStream*
+tensor_stream_create(void);
+
+// Wait for all work on a stream, then free it
+void
+tensor_stream_free(TensorStream* stream);
+
+// Wait for all work enqueued on a stream so far
+void
+tensor_stream_synchronize(TensorStream* stream);
+
+// Enqueue a generic operation on a stream
+TensorFuture*
+tensor_stream_enqueue(TensorStream* stream,
+                      TensorStreamOp op,
+                      TensorFuture* const* inputs,
+                      size_t num_inputs,
+                      void* arg);
+
+// Enqueue a unary operation on a stream
+TensorFuture*
+tensor_stream_unary(TensorStream* stream, TensorUnaryOp op, TensorFuture* input);
+
+// Enqueue a binary operation on a stream
+TensorFuture*
+tensor_stream_binary(TensorStream* stream,
+                     TensorBinaryOp op,
+                     TensorFuture* input1,
+                     TensorFuture* input2);
+
+// Enqueue an operation along an axis on a stream
+TensorFuture*
+tensor_stream_axis(TensorStream* stream,
+                   TensorAxisOp op,
+                   TensorFuture* input,
+                   size_t axis);
+
+// Enqueue an operation with a scalar on a stream
+TensorFuture*
+tensor_stream_scalar(TensorStream* stream,
+                     TensorScalarOp op,
+                     TensorFuture* input,
+                     tensor_dtype scalar);
+
+// Create a completed future holding a shared copy of an existing tensor
+TensorFuture*
+tensor_future_from_tensor(const Tensor* tensor);
+
+// Check if a future has completed without blocking
+int
+tensor_future_ready(TensorFuture* future);
+
+// Wait for a future and return its result, or NULL if the operation failed
+const Tensor*
+tensor_future_wait(TensorFuture* future);
+
+// Release a future, freeing its result once no operation still needs it
+void
+tensor_future_release(TensorFuture* future);
+
+// End of include guard
+#endif
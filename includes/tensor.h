@@ -8,15 +8,83 @@
 // Tensor data type
 typedef double tensor_dtype;
 
+// Maximum number of dimensions of a tensor
+#define TENSOR_MAX_DIMS 16
+
+// Maximum number of tensors a tensor iterator walks in lockstep
+#define TENSOR_ITER_MAX_OPERANDS 4
+
+// Reference-counted buffer holding the data of one or more tensors
+typedef struct TensorStorage TensorStorage;
+
 // Tensor definition
 typedef struct
 {
   tensor_dtype* data;
+  TensorStorage* storage;
   size_t* shape;
+  size_t* strides;
   size_t num_dims;
   size_t num_elements;
 } Tensor;
 
+// Capacity of a small tensor with inline shape and data
+#define TENSOR_SMALL_MAX_DIMS 4
+#define TENSOR_SMALL_MAX_ELEMENTS 16
+
+// Small tensor that lives on the stack, with its shape and data inline
+//
+// The embedded tensor points into the struct itself, so a small tensor must
+// not be copied by value or passed to tensor_free.
+typedef struct
+{
+  Tensor tensor;
+  size_t shape[TENSOR_SMALL_MAX_DIMS];
+  size_t strides[TENSOR_SMALL_MAX_DIMS];
+  tensor_dtype data[TENSOR_SMALL_MAX_ELEMENTS];
+} TensorSmall;
+
+// Iterator over one or more tensors sharing a common iteration shape
+typedef struct
+{
+  size_t num_operands;
+  size_t num_dims;
+  size_t shape[TENSOR_MAX_DIMS];
+  size_t strides[TENSOR_ITER_MAX_OPERANDS][TENSOR_MAX_DIMS];
+  size_t counter[TENSOR_MAX_DIMS];
+  size_t offsets[TENSOR_ITER_MAX_OPERANDS];
+  size_t inner_size;
+  size_t inner_strides[TENSOR_ITER_MAX_OPERANDS];
+  int done;
+} TensorIterator;
+
+// Activation applied element-wise, either standalone or fused into a GEMM
+typedef enum
+{
+  TENSOR_ACTIVATION_NONE,
+  TENSOR_ACTIVATION_RELU,
+  TENSOR_ACTIVATION_GELU,
+  TENSOR_ACTIVATION_SILU,
+  TENSOR_ACTIVATION_TANH
+} TensorActivation;
+
+// Register tile computed by the GEMM micro-kernel, as rows by columns
+typedef enum
+{
+  TENSOR_GEMM_KERNEL_4X4,
+  TENSOR_GEMM_KERNEL_8X4,
+  TENSOR_GEMM_KERNEL_4X8
+} TensorGemmKernel;
+
+// Cache blocking and micro-kernel of the matrix multiplication
+typedef struct
+{
+  size_t block_m;
+  size_t block_n;
+  size_t block_k;
+  TensorGemmKernel kernel;
+} TensorGemmConfig;
+
 // Create a new tensor
 Tensor*
 tensor_create(const size_t* shape, size_t num_dims);
@@ -25,16 +93,60 @@ tensor_create(const size_t* shape, size_t num_dims);
 void
 tensor_free(Tensor* tensor);
 
+// Create a copy of a tensor that shares its data until either is modified
+Tensor*
+tensor_clone(const Tensor* tensor);
+
+// Create a view of a tensor's data with a new shape
+Tensor*
+tensor_reshape(const Tensor* tensor, const size_t* shape, size_t num_dims);
+
+// Give a tensor its own copy of its data if the data is shared
+int
+tensor_make_writable(Tensor* tensor);
+
+// Create a new tensor filled with zeros
+Tensor*
+tensor_zeros(const size_t* shape, size_t num_dims);
+
+// Create a new tensor filled with a constant
+Tensor*
+tensor_full(const size_t* shape, size_t num_dims, tensor_dtype value);
+
+// Create a new one-dimensional tensor with values from start to stop by step
+Tensor*
+tensor_arange(tensor_dtype start, tensor_dtype stop, tensor_dtype step);
+
+// Fill a tensor with a constant in place
+int
+tensor_fill(Tensor* tensor, tensor_dtype value);
+
+// Initialize a small tensor in place and return its embedded tensor
+Tensor*
+tensor_small_init(TensorSmall* small, const size_t* shape, size_t num_dims);
+
 // Get index of element in tensor
 size_t
 tensor_get_index(const Tensor* tensor, const size_t* indices);
 
+// Initialize an iterator over operands with the given per-operand strides
+int
+tensor_iter_init(TensorIterator* iter,
+                 const size_t* shape,
+                 size_t num_dims,
+                 size_t num_operands,
+                 const size_t* const* strides);
+
+// Advance an iterator to its next inner run
+void
+tensor_iter_next(TensorIterator* iter);
+
 // Get value of element in tensor
 tensor_dtype
 tensor_get_value(const Tensor* tensor, const size_t* indices);
 
 // Set value of element in tensor
-tensor_dtype
+int
 tensor_set_value(Tensor* tensor, const size_t* indices, tensor_dtype value);
 
 // Pretty print tensor
@@ -57,6 +169,10 @@ tensor_dot(const Tensor* tensor1, const Tensor* tensor2);
 Tensor*
 tensor_add(const Tensor* tensor1, const Tensor* tensor2);
 
+// Compute the element-wise sum of two tensors into an existing tensor
+Tensor*
+tensor_add_into(const Tensor* tensor1, const Tensor* tensor2, Tensor* result);
+
 // Compute the element-wise difference of two tensors
 Tensor*
 tensor_subtract(const Tensor* tensor1, const Tensor* tensor2);
@@ -97,6 +213,26 @@ tensor_cos(const Tensor* tensor);
 Tensor*
 tensor_tan(const Tensor* tensor);
 
+// Compute the element-wise rectified linear unit of a tensor
+Tensor*
+tensor_relu(const Tensor* tensor);
+
+// Compute the element-wise Gaussian error linear unit of a tensor
+Tensor*
+tensor_gelu(const Tensor* tensor);
+
+// Compute the element-wise sigmoid linear unit of a tensor
+Tensor*
+tensor_silu(const Tensor* tensor);
+
+// Compute the element-wise hyperbolic tangent of a tensor
+Tensor*
+tensor_tanh(const Tensor* tensor);
+
+// Compute the element-wise activation of a tensor
+Tensor*
+tensor_activation(const Tensor* tensor, TensorActivation activation);
+
 // Compute the multiplication of a tensor by a scalar
 Tensor*
 tensor_scalar_multiply(const Tensor* tensor, tensor_dtype scalar);
@@ -109,14 +245,47 @@ tensor_scalar_divide(const Tensor* tensor, tensor_dtype scalar);
 Tensor*
 tensor_scalar_power(const Tensor* tensor, tensor_dtype scalar);
 
+// Get the configuration used by matrix multiplications
+TensorGemmConfig
+tensor_gemm_config(void);
+
+// Set the configuration used by matrix multiplications
+int
+tensor_set_gemm_config(const TensorGemmConfig* config);
+
 // Compute the matrix multiplication of two tensors
 Tensor*
 tensor_matmul(const Tensor* tensor1, const Tensor* tensor2);
 
+// Compute the matrix multiplication of two tensors into an existing tensor
+Tensor*
+tensor_matmul_into(const Tensor* tensor1,
+                   const Tensor* tensor2,
+                   Tensor* result);
+
+// Compute the matrix multiplication of each pair of slices along the last axis
+Tensor*
+tensor_batch_matmul(const Tensor* tensor1, const Tensor* tensor2);
+
+// Compute a dense layer: matmul plus optional bias, then an activation
+Tensor*
+tensor_linear(const Tensor* input,
+              const Tensor* weight,
+              const Tensor* bias,
+              TensorActivation activation);
+
 // Compute the transpose of a tensor
 Tensor*
 tensor_transpose(const Tensor* tensor);
 
+// Compute the transpose of a tensor into an existing tensor
+Tensor*
+tensor_transpose_into(const Tensor* tensor, Tensor* result);
+
+// Compute a tensor with its axes reordered
+Tensor*
+tensor_permute(const Tensor* tensor, const size_t* axes);
+
 // Compute the sum of a tensor along a given axis
 Tensor*
 tensor_sum(const Tensor* tensor, size_t axis);
@@ -137,5 +306,21 @@ tensor_min(const Tensor* tensor, size_t axis);
 Tensor*
 tensor_mode(const Tensor* tensor, size_t axis);
 
+// Compute the cumulative sum of a tensor along a given axis
+Tensor*
+tensor_cumsum(const Tensor* tensor, size_t axis);
+
+// Compute the cumulative product of a tensor along a given axis
+Tensor*
+tensor_cumprod(const Tensor* tensor, size_t axis);
+
+// Compute the running maximum of a tensor along a given axis
+Tensor*
+tensor_cummax(const Tensor* tensor, size_t axis);
+
+// Compute the running minimum of a tensor along a given axis
+Tensor*
+tensor_cummin(const Tensor* tensor, size_t axis);
+
 // End of include guard
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+// Include guard
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Includes
+#include <stddef.h>
+
+// Task run by the thread pool
+typedef void (*ThreadPoolTask)(void* arg);
+
+// Task run by the thread pool over a range of indices [begin, end)
+typedef void (*ThreadPoolRangeTask)(void* arg, size_t begin, size_t end);
+
+// Get the number of worker threads in the thread pool
+size_t
+thread_pool_num_threads(void);
+
+// Run a task asynchronously on the thread pool
+int
+thread_pool_submit(ThreadPoolTask task, void* arg);
+
+// Run a range task over [0, count) in chunks of grain indices and wait
+void
+thread_pool_parallel_for(size_t count,
+                         size_t grain,
+                         ThreadPoolRangeTask task,
+                         void* arg);
+
+// End of include guard
+#endif
@@ -0,0 +1,487 @@
+// Includes
+#include "../includes/autotune.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// Name of the tuning file under the user's cache directory
+#define TENSOR_TUNING_FILE_NAME "tensor_gemm.tune"
+
+// Maximum length of a path or of a line in the tuning file
+#define TENSOR_TUNING_MAX_LINE 1024
+
+// Number of timed runs per shape, of which the fastest counts
+#define TENSOR_AUTOTUNE_RUNS 3
+
+// Cache sizes assumed when the processor does not report them
+#define TENSOR_DEFAULT_L1 (32 * 1024)
+#define TENSOR_DEFAULT_L2 (256 * 1024)
+#define TENSOR_DEFAULT_L3 (2 * 1024 * 1024)
+
+// Names of the micro-kernels in the tuning file, indexed by TensorGemmKernel
+static const char* const tensor_autotune_kernels[] = { "4x4", "8x4", "4x8" };
+
+// Number of micro-kernels
+#define TENSOR_AUTOTUNE_NUM_KERNELS                                            \
+  (sizeof(tensor_autotune_kernels) / sizeof(tensor_autotune_kernels[0]))
+
+// Representative GEMM shapes as m, n and k: square, skinny and deep
+static const size_t tensor_autotune_shapes[][3] = { { 256, 256, 256 },
+                                                    { 1024, 64, 256 },
+                                                    { 128, 128, 1024 } };
+
+// Number of representative shapes
+#define TENSOR_AUTOTUNE_NUM_SHAPES                                             \
+  (sizeof(tensor_autotune_shapes) / sizeof(tensor_autotune_shapes[0]))
+
+// Candidate block sizes tried one dimension at a time
+static const size_t tensor_autotune_block_k[] = { 128, 256, 512 };
+static const size_t tensor_autotune_block_m[] = { 32, 64, 128, 256 };
+static const size_t tensor_autotune_block_n[] = { 64, 256, 1024 };
+
+// Clamp a block size to a range and round it down to a multiple of a tile
+static size_t
+tensor_autotune_clamp(size_t value, size_t low, size_t high, size_t multiple)
+{
+  value = value < low ? low : value > high ? high : value;
+  return value / multiple * multiple;
+}
+
+/**
+ * Reads the per-core data cache sizes of this machine.
+ *
+ * On x86 the sizes come from the deterministic cache parameters of cpuid,
+ * leaf 4 on Intel and leaf 0x8000001D on AMD, with shared caches divided
+ * among the logical processors sharing them. Sizes not found there are taken
+ * from sysconf, then from typical values.
+ *
+ * @param sizes Receives the L1, L2 and L3 sizes in bytes.
+ */
+static void
+tensor_autotune_caches(size_t sizes[3])
+{
+  sizes[0] = sizes[1] = sizes[2] = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  const unsigned int leaves[2] = { 4, 0x8000001D };
+  for (size_t l = 0; l < 2 && sizes[0] == 0; l++) {
+    if (__get_cpuid_max(leaves[l] & 0x80000000, NULL) < leaves[l]) {
+      continue;
+    }
+    for (unsigned int index = 0; index < 16; index++) {
+      unsigned int eax, ebx, ecx, edx;
+      __cpuid_count(leaves[l], index, eax, ebx, ecx, edx);
+      unsigned int type = eax & 0x1f;
+      unsigned int level = (eax >> 5) & 0x7;
+      if (type == 0) {
+        break;
+      }
+      if (type == 2 || level < 1 || level > 3) {
+        continue;
+      }
+      size_t size = (size_t)(((ebx >> 22) & 0x3ff) + 1) *
+                    (((ebx >> 12) & 0x3ff) + 1) * ((ebx & 0xfff) + 1) *
+                    ((size_t)ecx + 1);
+      size_t sharing = level == 3 ? ((eax >> 14) & 0xfff) + 1 : 1;
+      sizes[level - 1] = size / sharing;
+    }
+  }
+#endif
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  const int names[3] = { _SC_LEVEL1_DCACHE_SIZE,
+                         _SC_LEVEL2_CACHE_SIZE,
+                         _SC_LEVEL3_CACHE_SIZE };
+  for (size_t i = 0; i < 3; i++) {
+    long size = sizes[i] == 0 ? sysconf(names[i]) : 0;
+    if (size > 0) {
+      sizes[i] = (size_t)size;
+    }
+  }
+#endif
+  const size_t defaults[3] = { TENSOR_DEFAULT_L1,
+                               TENSOR_DEFAULT_L2,
+                               TENSOR_DEFAULT_L3 };
+  for (size_t i = 0; i < 3; i++) {
+    if (sizes[i] == 0) {
+      sizes[i] = defaults[i];
+    }
+  }
+}
+
+/**
+ * Gets a GEMM configuration derived from the cache sizes of this machine.
+ *
+ * The K block is sized so that a micro-panel of A and one of B fill half of
+ * L1, the M block so that the A block fills half of L2, and the N block so
+ * that the B block fills half of this core's share of L3.
+ *
+ * @return The heuristic configuration.
+ */
+TensorGemmConfig
+tensor_autotune_heuristic(void)
+{
+  size_t caches[3];
+  tensor_autotune_caches(caches);
+  size_t tile = 4;
+  TensorGemmConfig config;
+  config.kernel = TENSOR_GEMM_KERNEL_4X4;
+  config.block_k = tensor_autotune_clamp(
+    caches[0] / 2 / (2 * tile * sizeof(tensor_dtype)), 64, 1024, 16);
+  config.block_m = tensor_autotune_clamp(
+    caches[1] / 2 / (config.block_k * sizeof(tensor_dtype)), 16, 512, tile);
+  config.block_n = tensor_autotune_clamp(
+    caches[2] / 2 / (config.block_k * sizeof(tensor_dtype)), 64, 4096, tile);
+  return config;
+}
+
+// Build the key identifying this kind of machine in a tuning file
+static void
+tensor_autotune_host(char* key, size_t size)
+{
+  char brand[64] = "";
+#if defined(__x86_64__) || defined(__i386__)
+  if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004) {
+    unsigned int words[12];
+    for (unsigned int i = 0; i < 3; i++) {
+      __cpuid(0x80000002 + i,
+              words[4 * i],
+              words[4 * i + 1],
+              words[4 * i + 2],
+              words[4 * i + 3]);
+    }
+    memcpy(brand, words, sizeof(words));
+    brand[sizeof(words)] = '\0';
+  }
+#endif
+  if (brand[0] == '\0') {
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    char line[TENSOR_TUNING_MAX_LINE];
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+      char* colon = strchr(line, ':');
+      if (colon != NULL && strncmp(line, "model name", 10) == 0) {
+        snprintf(brand, sizeof(brand), "%s", colon + 1);
+        break;
+      }
+    }
+    if (file != NULL) {
+      fclose(file);
+    }
+  }
+
+  // Trim the brand and keep the key on one field of one line
+  char* start = brand;
+  while (*start == ' ') {
+    start++;
+  }
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  snprintf(key,
+           size,
+           "%s/%ld",
+           *start != '\0' ? start : "unknown",
+           cores > 0 ? cores : 1);
+  for (char* c = key; *c != '\0'; c++) {
+    if (*c == '\t' || *c == '\n') {
+      *c = ' ';
+    }
+  }
+}
+
+// Get the tuning file path, from the environment or the user's cache
+static int
+tensor_autotune_path(char* path, size_t size)
+{
+  const char* env = getenv(TENSOR_TUNING_FILE_ENV);
+  if (env != NULL && env[0] != '\0') {
+    snprintf(path, size, "%s", env);
+    return 0;
+  }
+  const char* cache = getenv("XDG_CACHE_HOME");
+  if (cache != NULL && cache[0] != '\0') {
+    snprintf(path, size, "%s/%s", cache, TENSOR_TUNING_FILE_NAME);
+    return 0;
+  }
+  const char* home = getenv("HOME");
+  if (home != NULL && home[0] != '\0') {
+    snprintf(path, size, "%s/.cache/%s", home, TENSOR_TUNING_FILE_NAME);
+    return 0;
+  }
+  return -1;
+}
+
+// Read the configuration saved for this machine from a tuning file
+static int
+tensor_autotune_read(const char* path, TensorGemmConfig* config)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  char key[TENSOR_TUNING_MAX_LINE];
+  tensor_autotune_host(key, sizeof(key));
+  size_t key_length = strlen(key);
+
+  // Find the line of this machine, keeping the last one if there are several
+  int found = -1;
+  char line[TENSOR_TUNING_MAX_LINE];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, key, key_length) != 0 || line[key_length] != '\t') {
+      continue;
+    }
+    TensorGemmConfig parsed;
+    char kernel[16];
+    if (sscanf(line + key_length + 1,
+               "%zu %zu %zu %15s",
+               &parsed.block_m,
+               &parsed.block_n,
+               &parsed.block_k,
+               kernel) != 4 ||
+        parsed.block_m == 0 || parsed.block_n == 0 || parsed.block_k == 0) {
+      continue;
+    }
+    for (size_t i = 0; i < TENSOR_AUTOTUNE_NUM_KERNELS; i++) {
+      if (strcmp(kernel, tensor_autotune_kernels[i]) == 0) {
+        parsed.kernel = (TensorGemmKernel)i;
+        *config = parsed;
+        found = 0;
+      }
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/**
+ * Saves the configuration of this machine to a tuning file.
+ *
+ * Lines of other machines are kept, so one file can serve every host type
+ * sharing a home directory. The file is rewritten through a temporary file
+ * and a rename, so readers never see a partial file.
+ *
+ * @param path The path of the tuning file.
+ * @param config The configuration to save.
+ * @return 0 on success, or -1 if the file cannot be written.
+ */
+static int
+tensor_autotune_write(const char* path, const TensorGemmConfig* config)
+{
+  char key[TENSOR_TUNING_MAX_LINE];
+  tensor_autotune_host(key, sizeof(key));
+  size_t key_length = strlen(key);
+  char temp[TENSOR_TUNING_MAX_LINE + 16];
+  snprintf(temp, sizeof(temp), "%s.%ld", path, (long)getpid());
+  FILE* output = fopen(temp, "w");
+  if (output == NULL) {
+    return -1;
+  }
+
+  // Copy the lines of other machines
+  FILE* input = fopen(path, "r");
+  char line[TENSOR_TUNING_MAX_LINE];
+  if (input == NULL) {
+    fprintf(output, "# GEMM tuning: machine\tblock_m block_n block_k kernel\n");
+  }
+  while (input != NULL && fgets(line, sizeof(line), input) != NULL) {
+    if (strncmp(line, key, key_length) != 0 || line[key_length] != '\t') {
+      fputs(line, output);
+    }
+  }
+  if (input != NULL) {
+    fclose(input);
+  }
+
+  fprintf(output,
+          "%s\t%zu %zu %zu %s\n",
+          key,
+          config->block_m,
+          config->block_n,
+          config->block_k,
+          tensor_autotune_kernels[config->kernel]);
+  if (fclose(output) != 0 || rename(temp, path) != 0) {
+    remove(temp);
+    return -1;
+  }
+  return 0;
+}
+
+// Apply the GEMM configuration saved for this machine in a tuning file
+int
+tensor_autotune_load(const char* path)
+{
+  char default_path[TENSOR_TUNING_MAX_LINE];
+  if (path == NULL) {
+    if (tensor_autotune_path(default_path, sizeof(default_path)) != 0) {
+      return -1;
+    }
+    path = default_path;
+  }
+  TensorGemmConfig config;
+  if (tensor_autotune_read(path, &config) != 0) {
+    return -1;
+  }
+  return tensor_set_gemm_config(&config);
+}
+
+// Get the GEMM configuration to start with, tuned if a tuning file has one
+TensorGemmConfig
+tensor_autotune_startup_config(void)
+{
+  char path[TENSOR_TUNING_MAX_LINE];
+  TensorGemmConfig config;
+  if (tensor_autotune_path(path, sizeof(path)) == 0 &&
+      tensor_autotune_read(path, &config) == 0) {
+    return config;
+  }
+  return tensor_autotune_heuristic();
+}
+
+// Time a configuration on every representative shape, in seconds
+static double
+tensor_autotune_measure(const TensorGemmConfig* config,
+                        Tensor* const* operands)
+{
+  tensor_set_gemm_config(config);
+  double total = 0;
+  for (size_t s = 0; s < TENSOR_AUTOTUNE_NUM_SHAPES; s++) {
+    double best = 0;
+    for (size_t run = 0; run < TENSOR_AUTOTUNE_RUNS; run++) {
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      tensor_matmul_into(
+        operands[3 * s], operands[3 * s + 1], operands[3 * s + 2]);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double elapsed = (double)(end.tv_sec - start.tv_sec) +
+                       1e-9 * (double)(end.tv_nsec - start.tv_nsec);
+      if (run == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    total += best;
+  }
+  return total;
+}
+
+// Try a candidate configuration and keep it if it beats the best so far
+static void
+tensor_autotune_try(const TensorGemmConfig* candidate,
+                    Tensor* const* operands,
+                    TensorGemmConfig* best,
+                    double* best_time)
+{
+  if (candidate->block_m == best->block_m &&
+      candidate->block_n == best->block_n &&
+      candidate->block_k == best->block_k &&
+      candidate->kernel == best->kernel) {
+    return;
+  }
+  double elapsed = tensor_autotune_measure(candidate, operands);
+  if (elapsed < *best_time) {
+    *best = *candidate;
+    *best_time = elapsed;
+  }
+}
+
+/**
+ * Benchmarks GEMM configurations, then applies and saves the fastest one.
+ *
+ * Starting from the cache heuristics, the search tries each micro-kernel,
+ * then each K, M and N block size in turn, keeping a change only if it
+ * lowers the total time over square, skinny and deep shapes. The result is
+ * applied to this process and saved under this machine's processor model and
+ * core count, for every later process to load at startup. Matrix
+ * multiplications running concurrently use the candidates being measured.
+ *
+ * @param path The tuning file to write, or NULL for the file loaded at startup.
+ * @param best Receives the fastest configuration, or NULL.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_autotune(const char* path, TensorGemmConfig* best)
+{
+  char default_path[TENSOR_TUNING_MAX_LINE];
+  if (path == NULL) {
+    if (tensor_autotune_path(default_path, sizeof(default_path)) != 0) {
+      fprintf(stderr, "Error: No tuning file path\n");
+      return -1;
+    }
+    path = default_path;
+
+    // Create the cache directory if the default file lives there
+    if (getenv(TENSOR_TUNING_FILE_ENV) == NULL) {
+      char* slash = strrchr(default_path, '/');
+      *slash = '\0';
+      mkdir(default_path, 0755);
+      *slash = '/';
+    }
+  }
+
+  // Keep the installed configuration to restore if the search cannot run
+  TensorGemmConfig original = tensor_gemm_config();
+
+  // Create operands for the representative shapes
+  Tensor* operands[3 * TENSOR_AUTOTUNE_NUM_SHAPES] = { NULL };
+  int failed = 0;
+  for (size_t s = 0; s < TENSOR_AUTOTUNE_NUM_SHAPES; s++) {
+    size_t m = tensor_autotune_shapes[s][0];
+    size_t n = tensor_autotune_shapes[s][1];
+    size_t k = tensor_autotune_shapes[s][2];
+    const size_t shapes[3][2] = { { m, k }, { k, n }, { m, n } };
+    for (size_t i = 0; i < 3; i++) {
+      operands[3 * s + i] = tensor_full(shapes[i], 2, 0.5);
+      failed |= operands[3 * s + i] == NULL;
+    }
+  }
+
+  // Search one parameter at a time from the heuristic configuration
+  TensorGemmConfig fastest = tensor_autotune_heuristic();
+  if (!failed) {
+    double fastest_time = tensor_autotune_measure(&fastest, operands);
+    TensorGemmConfig candidate = fastest;
+    for (size_t i = 0; i < TENSOR_AUTOTUNE_NUM_KERNELS; i++) {
+      candidate.kernel = (TensorGemmKernel)i;
+      tensor_autotune_try(&candidate, operands, &fastest, &fastest_time);
+    }
+    candidate = fastest;
+    for (size_t i = 0; i < sizeof(tensor_autotune_block_k) / sizeof(size_t);
+         i++) {
+      candidate.block_k = tensor_autotune_block_k[i];
+      tensor_autotune_try(&candidate, operands, &fastest, &fastest_time);
+    }
+    candidate = fastest;
+    for (size_t i = 0; i < sizeof(tensor_autotune_block_m) / sizeof(size_t);
+         i++) {
+      candidate.block_m = tensor_autotune_block_m[i];
+      tensor_autotune_try(&candidate, operands, &fastest, &fastest_time);
+    }
+    candidate = fastest;
+    for (size_t i = 0; i < sizeof(tensor_autotune_block_n) / sizeof(size_t);
+         i++) {
+      candidate.block_n = tensor_autotune_block_n[i];
+      tensor_autotune_try(&candidate, operands, &fastest, &fastest_time);
+    }
+  }
+  for (size_t i = 0; i < 3 * TENSOR_AUTOTUNE_NUM_SHAPES; i++) {
+    if (operands[i] != NULL) {
+      tensor_free(operands[i]);
+    }
+  }
+  if (failed) {
+    tensor_set_gemm_config(&original);
+    return -1;
+  }
+  tensor_set_gemm_config(&fastest);
+  if (best != NULL) {
+    *best = fastest;
+  }
+
+  // Save the result for later processes
+  if (tensor_autotune_write(path, &fastest) != 0) {
+    fprintf(stderr, "Error: Unable to write tuning file\n");
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,628 @@
+// Includes
+#include "../includes/collective.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Marks a shared segment whose header has been initialized by rank 0
+#define TENSOR_COMM_MAGIC 0x54454e53434f4d4dull
+
+// Number of elements moved between progress updates
+#define TENSOR_COMM_CHUNK 8192
+
+// Number of elements summed at once on the stack
+#define TENSOR_COMM_BLOCK 512
+
+// Number of busy polls before a waiting rank starts yielding its processor
+#define TENSOR_COMM_SPINS 1024
+
+// Number of milliseconds a rank waits for all ranks to attach
+#define TENSOR_COMM_ATTACH_TIMEOUT 30000
+
+// Size of a cache line, used to keep counters of different ranks apart
+#define TENSOR_COMM_LINE 64
+
+// Header at the start of the shared segment
+typedef struct
+{
+  _Alignas(TENSOR_COMM_LINE) _Atomic uint64_t magic;
+  uint64_t session;
+  uint64_t world_size;
+  uint64_t capacity;
+  _Atomic uint64_t attached;
+  _Alignas(TENSOR_COMM_LINE) _Atomic uint64_t barrier_count;
+  _Atomic uint64_t barrier_generation;
+} TensorCommHeader;
+
+// Progress counters published by one rank, tagged with the round number
+typedef struct
+{
+  _Alignas(TENSOR_COMM_LINE) _Atomic uint64_t staged;
+  _Atomic uint64_t reduced;
+} TensorCommRank;
+
+// Communicator as seen by one process
+struct TensorCommunicator
+{
+  size_t rank;
+  size_t world_size;
+  size_t capacity;
+  uint64_t round;
+  void* mapping;
+  size_t mapping_size;
+  TensorCommHeader* header;
+  TensorCommRank* ranks;
+  tensor_dtype* slots;
+};
+
+// One round of a collective, moving at most capacity elements per rank
+typedef struct
+{
+  const tensor_dtype* input;
+  size_t count;
+  size_t part_size;
+  size_t part_stride;
+  size_t next;
+  uint64_t tag;
+} TensorCommRound;
+
+// Get the staging slot of a rank
+static tensor_dtype*
+tensor_comm_slot(const TensorCommunicator* comm, size_t rank)
+{
+  return comm->slots + rank * comm->capacity;
+}
+
+// Get the first element of a round reduced by a rank
+static size_t
+tensor_comm_segment(const TensorCommunicator* comm,
+                    const TensorCommRound* round,
+                    size_t rank)
+{
+  return round->count * rank / comm->world_size;
+}
+
+// Spin briefly, then yield so waiting ranks do not starve working ones
+static void
+tensor_comm_pause(size_t* spins)
+{
+  if (*spins < TENSOR_COMM_SPINS) {
+    (*spins)++;
+  } else {
+    sched_yield();
+  }
+}
+
+// Check, or wait if blocking, until a progress counter reaches a target
+static int
+tensor_comm_poll(_Atomic uint64_t* counter, uint64_t target, int blocking)
+{
+  size_t spins = 0;
+  while (atomic_load_explicit(counter, memory_order_acquire) < target) {
+    if (!blocking) {
+      return 0;
+    }
+    tensor_comm_pause(&spins);
+  }
+  return 1;
+}
+
+// Get the current time in milliseconds
+static uint64_t
+tensor_comm_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+// Wait until a counter in shared memory holds a value, or a deadline passes
+static int
+tensor_comm_wait_equal(_Atomic uint64_t* counter,
+                       uint64_t value,
+                       uint64_t deadline)
+{
+  size_t spins = 0;
+  while (atomic_load_explicit(counter, memory_order_acquire) != value) {
+    if (tensor_comm_now() >= deadline) {
+      return -1;
+    }
+    tensor_comm_pause(&spins);
+  }
+  return 0;
+}
+
+// Open and map the segment published by rank 0 for a session, skipping any
+// stale segment left under the same name by an earlier job
+static void*
+tensor_comm_attach(const char* name,
+                   uint64_t session,
+                   size_t mapping_size,
+                   uint64_t deadline)
+{
+  while (tensor_comm_now() < deadline) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0 && errno != ENOENT) {
+      return MAP_FAILED;
+    }
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        (size_t)st.st_size >= mapping_size) {
+      mapping = mmap(
+        NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+
+    // Accept the segment only once rank 0 has published this session in it
+    if (mapping != MAP_FAILED) {
+      TensorCommHeader* header = (TensorCommHeader*)mapping;
+      if (atomic_load_explicit(&header->magic, memory_order_acquire) ==
+            TENSOR_COMM_MAGIC &&
+          header->session == session) {
+        return mapping;
+      }
+      munmap(mapping, mapping_size);
+    }
+    usleep(1000);
+  }
+  return MAP_FAILED;
+}
+
+/**
+ * Joins a communicator backed by a POSIX shared memory segment.
+ *
+ * Every rank from 0 to world_size - 1 must call this with the same name,
+ * session and capacity, and the session must be unique to each launch of
+ * the job, such as the launcher's process id. Rank 0 creates the segment,
+ * unlinking any stale segment left under the name by a crashed job, and
+ * publishes the session in it. The other ranks only accept a segment
+ * holding their session, so they never attach to a stale one, even if they
+ * open it before rank 0 unlinks it. Rank 0 unlinks the segment again once
+ * all ranks have mapped it, so nothing outlives the job. Ranks give up if
+ * the others have not joined within TENSOR_COMM_ATTACH_TIMEOUT. Collectives
+ * move tensors of any size in rounds of at most capacity elements per rank.
+ *
+ * @param name The name of the shared memory segment, starting with a slash.
+ * @param session The identifier of this launch of the job.
+ * @param rank The rank of the calling process.
+ * @param world_size The number of processes.
+ * @param capacity The number of staging elements per rank.
+ * @return A pointer to the communicator, or NULL if an error occurs.
+ */
+TensorCommunicator*
+tensor_comm_create(const char* name,
+                   uint64_t session,
+                   size_t rank,
+                   size_t world_size,
+                   size_t capacity)
+{
+  // Check if arguments are valid
+  if (name == NULL || world_size == 0 || rank >= world_size || capacity == 0) {
+    fprintf(stderr, "Error: Invalid communicator arguments\n");
+    return NULL;
+  }
+
+  TensorCommunicator* comm =
+    (TensorCommunicator*)malloc(sizeof(TensorCommunicator));
+  if (comm == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for communicator\n");
+    return NULL;
+  }
+  comm->rank = rank;
+  comm->world_size = world_size;
+  comm->capacity = capacity;
+  comm->round = 0;
+  comm->mapping_size = sizeof(TensorCommHeader) +
+                       world_size * sizeof(TensorCommRank) +
+                       world_size * capacity * sizeof(tensor_dtype);
+  uint64_t deadline = tensor_comm_now() + TENSOR_COMM_ATTACH_TIMEOUT;
+
+  // Create the segment on rank 0 and attach to this session's on the others
+  if (rank == 0) {
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    comm->mapping = MAP_FAILED;
+    if (fd >= 0) {
+      if (ftruncate(fd, (off_t)comm->mapping_size) == 0) {
+        comm->mapping = mmap(NULL,
+                             comm->mapping_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED,
+                             fd,
+                             0);
+      }
+      close(fd);
+      if (comm->mapping == MAP_FAILED) {
+        shm_unlink(name);
+      }
+    }
+  } else {
+    comm->mapping =
+      tensor_comm_attach(name, session, comm->mapping_size, deadline);
+  }
+  if (comm->mapping == MAP_FAILED) {
+    fprintf(stderr, "Error: Unable to map shared memory segment\n");
+    free(comm);
+    return NULL;
+  }
+  comm->header = (TensorCommHeader*)comm->mapping;
+  comm->ranks = (TensorCommRank*)(comm->header + 1);
+  comm->slots = (tensor_dtype*)(comm->ranks + world_size);
+
+  // Publish the layout from rank 0 and check it on the others
+  if (rank == 0) {
+    comm->header->session = session;
+    comm->header->world_size = world_size;
+    comm->header->capacity = capacity;
+    atomic_store_explicit(
+      &comm->header->magic, TENSOR_COMM_MAGIC, memory_order_release);
+  } else if (comm->header->world_size != world_size ||
+             comm->header->capacity != capacity) {
+    fprintf(stderr, "Error: Communicator layout does not match rank 0\n");
+    munmap(comm->mapping, comm->mapping_size);
+    free(comm);
+    return NULL;
+  }
+
+  // Wait for every rank to map the segment, then remove its name
+  atomic_fetch_add_explicit(&comm->header->attached, 1, memory_order_acq_rel);
+  int status =
+    tensor_comm_wait_equal(&comm->header->attached, world_size, deadline);
+  if (rank == 0) {
+    shm_unlink(name);
+  }
+  if (status != 0) {
+    fprintf(stderr, "Error: Timed out waiting for ranks to attach\n");
+    munmap(comm->mapping, comm->mapping_size);
+    free(comm);
+    return NULL;
+  }
+  return comm;
+}
+
+// Leave a communicator and unmap its shared memory
+void
+tensor_comm_free(TensorCommunicator* comm)
+{
+  if (comm != NULL) {
+    munmap(comm->mapping, comm->mapping_size);
+    free(comm);
+  }
+}
+
+// Get the rank of the calling process in a communicator
+size_t
+tensor_comm_rank(const TensorCommunicator* comm)
+{
+  return comm->rank;
+}
+
+// Get the number of processes in a communicator
+size_t
+tensor_comm_world_size(const TensorCommunicator* comm)
+{
+  return comm->world_size;
+}
+
+// Wait until every rank has reached the barrier
+void
+tensor_comm_barrier(TensorCommunicator* comm)
+{
+  TensorCommHeader* header = comm->header;
+  uint64_t generation =
+    atomic_load_explicit(&header->barrier_generation, memory_order_acquire);
+  if (atomic_fetch_add_explicit(
+        &header->barrier_count, 1, memory_order_acq_rel) ==
+      comm->world_size - 1) {
+    atomic_store_explicit(&header->barrier_count, 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(
+      &header->barrier_generation, 1, memory_order_release);
+    return;
+  }
+  size_t spins = 0;
+  while (atomic_load_explicit(&header->barrier_generation,
+                              memory_order_acquire) == generation) {
+    tensor_comm_pause(&spins);
+  }
+}
+
+// Start a round once every rank is done reading the slots of the last one
+static void
+tensor_comm_begin(TensorCommunicator* comm, TensorCommRound* round)
+{
+  tensor_comm_barrier(comm);
+  comm->round++;
+  round->tag = comm->round << 32;
+  round->next = tensor_comm_segment(comm, round, comm->rank);
+}
+
+/**
+ * Sums the staged chunks of this rank's segment of a round.
+ *
+ * Each chunk is summed as soon as every rank has staged it, so reduction
+ * overlaps with slower ranks still copying later chunks in. Sums are taken
+ * in rank order, making the result bitwise identical on every rank and
+ * independent of timing. The sum overwrites this rank's own slot, which no
+ * other rank reads within its segment.
+ *
+ * @param comm The communicator.
+ * @param round The current round.
+ * @param blocking Whether to wait for chunks that are not staged yet.
+ */
+static void
+tensor_comm_reduce(TensorCommunicator* comm,
+                   TensorCommRound* round,
+                   int blocking)
+{
+  size_t begin = tensor_comm_segment(comm, round, comm->rank);
+  size_t end = tensor_comm_segment(comm, round, comm->rank + 1);
+  tensor_dtype* own = tensor_comm_slot(comm, comm->rank);
+  while (round->next < end) {
+    size_t start = round->next;
+    size_t stop =
+      start + TENSOR_COMM_CHUNK < end ? start + TENSOR_COMM_CHUNK : end;
+
+    // Check that every rank has staged the chunk
+    uint64_t needed =
+      round->tag | (stop + TENSOR_COMM_CHUNK - 1) / TENSOR_COMM_CHUNK;
+    for (size_t q = 0; q < comm->world_size; q++) {
+      if (!tensor_comm_poll(&comm->ranks[q].staged, needed, blocking)) {
+        return;
+      }
+    }
+
+    // Sum the chunk block by block
+    for (size_t i = start; i < stop; i += TENSOR_COMM_BLOCK) {
+      size_t length =
+        stop - i < TENSOR_COMM_BLOCK ? stop - i : TENSOR_COMM_BLOCK;
+      tensor_dtype sum[TENSOR_COMM_BLOCK];
+      memcpy(sum, tensor_comm_slot(comm, 0) + i, length * sizeof(tensor_dtype));
+      for (size_t q = 1; q < comm->world_size; q++) {
+        const tensor_dtype* slot = tensor_comm_slot(comm, q) + i;
+        for (size_t j = 0; j < length; j++) {
+          sum[j] += slot[j];
+        }
+      }
+      memcpy(own + i, sum, length * sizeof(tensor_dtype));
+    }
+
+    // Publish the reduced chunk
+    round->next = stop;
+    atomic_store_explicit(&comm->ranks[comm->rank].reduced,
+                          round->tag | (stop - begin + TENSOR_COMM_CHUNK - 1) /
+                                         TENSOR_COMM_CHUNK,
+                          memory_order_release);
+  }
+}
+
+/**
+ * Copies the input of a round into this rank's slot chunk by chunk.
+ *
+ * The round's elements are read as consecutive parts of part_size elements,
+ * placed part_stride elements apart in the input. After each chunk the rank
+ * publishes its progress and, when reducing, sums whatever chunks of its own
+ * segment are already staged everywhere before copying the next one.
+ *
+ * @param comm The communicator.
+ * @param round The current round.
+ * @param reduce Whether to reduce this rank's segment while staging.
+ */
+static void
+tensor_comm_stage(TensorCommunicator* comm, TensorCommRound* round, int reduce)
+{
+  tensor_dtype* slot = tensor_comm_slot(comm, comm->rank);
+  for (size_t begin = 0; begin < round->count; begin += TENSOR_COMM_CHUNK) {
+    size_t end = begin + TENSOR_COMM_CHUNK < round->count
+                   ? begin + TENSOR_COMM_CHUNK
+                   : round->count;
+
+    // Copy the chunk, which may span several parts
+    for (size_t v = begin; v < end;) {
+      size_t part = v / round->part_size;
+      size_t offset = v % round->part_size;
+      size_t length = end - v < round->part_size - offset
+                        ? end - v
+                        : round->part_size - offset;
+      memcpy(slot + v,
+             round->input + part * round->part_stride + offset,
+             length * sizeof(tensor_dtype));
+      v += length;
+    }
+    atomic_store_explicit(&comm->ranks[comm->rank].staged,
+                          round->tag | (end + TENSOR_COMM_CHUNK - 1) /
+                                         TENSOR_COMM_CHUNK,
+                          memory_order_release);
+    if (reduce) {
+      tensor_comm_reduce(comm, round, 0);
+    }
+  }
+  if (reduce) {
+    tensor_comm_reduce(comm, round, 1);
+  }
+}
+
+// Copy chunks published by a rank out of its slot as they become ready
+static void
+tensor_comm_collect(TensorCommunicator* comm,
+                    const TensorCommRound* round,
+                    size_t rank,
+                    int reduced,
+                    size_t begin,
+                    size_t end,
+                    tensor_dtype* output)
+{
+  _Atomic uint64_t* counter =
+    reduced ? &comm->ranks[rank].reduced : &comm->ranks[rank].staged;
+  const tensor_dtype* slot = tensor_comm_slot(comm, rank);
+  for (size_t start = begin; start < end; start += TENSOR_COMM_CHUNK) {
+    size_t stop =
+      start + TENSOR_COMM_CHUNK < end ? start + TENSOR_COMM_CHUNK : end;
+    tensor_comm_poll(
+      counter,
+      round->tag | ((start - begin) / TENSOR_COMM_CHUNK + 1),
+      1);
+    memcpy(output + start, slot + start, (stop - start) * sizeof(tensor_dtype));
+  }
+}
+
+/**
+ * Sums a tensor across all ranks in place.
+ *
+ * Each round stages every rank's elements in shared memory, lets rank r sum
+ * the r-th of world_size equal segments, and gathers the reduced segments
+ * back. This moves the same data as a ring reduce-scatter and allgather but
+ * without passing chunks through intermediate ranks. All stages run chunk
+ * by chunk, so copying, summing and gathering of different chunks overlap.
+ *
+ * @param comm The communicator.
+ * @param tensor The tensor to sum, with the same shape on every rank.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_allreduce(TensorCommunicator* comm, Tensor* tensor)
+{
+  if (tensor_make_writable(tensor) != 0) {
+    return -1;
+  }
+  for (size_t offset = 0; offset < tensor->num_elements;
+       offset += comm->capacity) {
+    size_t count = tensor->num_elements - offset < comm->capacity
+                     ? tensor->num_elements - offset
+                     : comm->capacity;
+    TensorCommRound round = { tensor->data + offset, count, count, 0, 0, 0 };
+    tensor_comm_begin(comm, &round);
+    tensor_comm_stage(comm, &round, 1);
+
+    // Gather reduced segments, starting after our own to spread the load
+    for (size_t i = 1; i <= comm->world_size; i++) {
+      size_t q = (comm->rank + i) % comm->world_size;
+      tensor_comm_collect(comm,
+                          &round,
+                          q,
+                          1,
+                          tensor_comm_segment(comm, &round, q),
+                          tensor_comm_segment(comm, &round, q + 1),
+                          tensor->data + offset);
+    }
+  }
+  return 0;
+}
+
+// Copy a tensor from the root rank to all other ranks in place
+int
+tensor_broadcast(TensorCommunicator* comm, Tensor* tensor, size_t root)
+{
+  // Check if root is valid
+  if (root >= comm->world_size) {
+    fprintf(stderr, "Error: Root rank is out of bounds\n");
+    return -1;
+  }
+  if (comm->rank != root && tensor_make_writable(tensor) != 0) {
+    return -1;
+  }
+  for (size_t offset = 0; offset < tensor->num_elements;
+       offset += comm->capacity) {
+    size_t count = tensor->num_elements - offset < comm->capacity
+                     ? tensor->num_elements - offset
+                     : comm->capacity;
+    TensorCommRound round = { tensor->data + offset, count, count, 0, 0, 0 };
+    tensor_comm_begin(comm, &round);
+    if (comm->rank == root) {
+      tensor_comm_stage(comm, &round, 0);
+    } else {
+      tensor_comm_collect(
+        comm, &round, root, 0, 0, count, tensor->data + offset);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Sums a tensor across all ranks and keeps this rank's share of the sum.
+ *
+ * The input is split into world_size equal parts and rank r receives the sum
+ * of part r. Each round stages the next piece of every part, so rank r only
+ * ever sums elements that it keeps.
+ *
+ * @param comm The communicator.
+ * @param input The tensor to sum, with the same size on every rank.
+ * @param output The tensor receiving this rank's part of the sum.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_reduce_scatter(TensorCommunicator* comm,
+                      const Tensor* input,
+                      Tensor* output)
+{
+  // Check if sizes are compatible
+  size_t part_size = output->num_elements;
+  if (input->num_elements != part_size * comm->world_size) {
+    fprintf(stderr, "Error: Output must hold an equal part of the input\n");
+    return -1;
+  }
+  if (comm->capacity < comm->world_size) {
+    fprintf(stderr, "Error: Communicator capacity is too small\n");
+    return -1;
+  }
+  if (tensor_make_writable(output) != 0) {
+    return -1;
+  }
+  size_t piece = comm->capacity / comm->world_size;
+  for (size_t offset = 0; offset < part_size; offset += piece) {
+    size_t length = part_size - offset < piece ? part_size - offset : piece;
+    TensorCommRound round = {
+      input->data + offset, length * comm->world_size, length, part_size, 0, 0
+    };
+    tensor_comm_begin(comm, &round);
+    tensor_comm_stage(comm, &round, 1);
+    memcpy(output->data + offset,
+           tensor_comm_slot(comm, comm->rank) + comm->rank * length,
+           length * sizeof(tensor_dtype));
+  }
+  return 0;
+}
+
+// Concatenate a tensor from every rank, in rank order, on all ranks
+int
+tensor_allgather(TensorCommunicator* comm, const Tensor* input, Tensor* output)
+{
+  // Check if sizes are compatible
+  size_t part_size = input->num_elements;
+  if (output->num_elements != part_size * comm->world_size) {
+    fprintf(stderr, "Error: Output must hold the input of every rank\n");
+    return -1;
+  }
+  if (tensor_make_writable(output) != 0) {
+    return -1;
+  }
+  for (size_t offset = 0; offset < part_size; offset += comm->capacity) {
+    size_t count = part_size - offset < comm->capacity ? part_size - offset
+                                                       : comm->capacity;
+    TensorCommRound round = { input->data + offset, count, count, 0, 0, 0 };
+    tensor_comm_begin(comm, &round);
+    tensor_comm_stage(comm, &round, 0);
+    for (size_t i = 0; i < comm->world_size; i++) {
+      size_t q = (comm->rank + i) % comm->world_size;
+      tensor_comm_collect(comm,
+                          &round,
+                          q,
+                          0,
+                          0,
+                          count,
+                          output->data + q * part_size + offset);
+    }
+  }
+  return 0;
+}
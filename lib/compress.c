@@ -0,0 +1,695 @@
+// Includes
+#include "../includes/compress.h"
+#include "../includes/thread_pool.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of bytes of a full block
+#define TENSOR_COMPRESS_BLOCK_BYTES                                            \
+  (TENSOR_COMPRESS_BLOCK * sizeof(tensor_dtype))
+
+// Magic number and version at the start of a compressed tensor file
+#define TENSOR_COMPRESS_MAGIC 0x315A534E4554ULL
+#define TENSOR_COMPRESS_VERSION 1
+
+// Number of bits of the match finder's hash table
+#define TENSOR_LZ_HASH_BITS 12
+
+// Length of the shortest match worth encoding
+#define TENSOR_LZ_MIN_MATCH 4
+
+// Shift of the miss count giving how far the match finder skips ahead, so
+// incompressible blocks are scanned quickly
+#define TENSOR_LZ_SKIP_SHIFT 5
+
+// Tensor held as losslessly compressed blocks
+struct TensorCompressed
+{
+  size_t* shape;
+  size_t num_dims;
+  size_t num_elements;
+  size_t num_blocks;
+  size_t* offsets;
+  unsigned char* data;
+};
+
+// Arguments of a parallel block compression or decompression
+typedef struct
+{
+  TensorCompressed* compressed;
+  const tensor_dtype* values;
+  tensor_dtype* result;
+  unsigned char* staging;
+  _Atomic int failed;
+} TensorCompressTask;
+
+// Group the bytes of each element by significance, so that repeated
+// exponents and zeros form runs
+static void
+tensor_shuffle(const tensor_dtype* values, size_t count, unsigned char* bytes)
+{
+  const unsigned char* src = (const unsigned char*)values;
+  for (size_t b = 0; b < sizeof(tensor_dtype); b++) {
+    unsigned char* plane = bytes + b * count;
+    for (size_t i = 0; i < count; i++) {
+      plane[i] = src[i * sizeof(tensor_dtype) + b];
+    }
+  }
+}
+
+// Restore elements from bytes grouped by significance
+static void
+tensor_unshuffle(const unsigned char* bytes, size_t count, tensor_dtype* values)
+{
+  unsigned char* dst = (unsigned char*)values;
+  for (size_t b = 0; b < sizeof(tensor_dtype); b++) {
+    const unsigned char* plane = bytes + b * count;
+    for (size_t i = 0; i < count; i++) {
+      dst[i * sizeof(tensor_dtype) + b] = plane[i];
+    }
+  }
+}
+
+// Write the part of a sequence length that does not fit its token field
+static unsigned char*
+tensor_lz_write_length(unsigned char* op, size_t length)
+{
+  for (; length >= 255; length -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (unsigned char)length;
+  return op;
+}
+
+// Write literals followed by a match, or by nothing if the offset is zero,
+// returning NULL if the sequence does not fit
+static unsigned char*
+tensor_lz_write_sequence(unsigned char* op,
+                         const unsigned char* end,
+                         const unsigned char* literals,
+                         size_t num_literals,
+                         size_t offset,
+                         size_t match)
+{
+  size_t code = offset != 0 ? match - TENSOR_LZ_MIN_MATCH : 0;
+  if (num_literals + num_literals / 255 + code / 255 + 5 >
+      (size_t)(end - op)) {
+    return NULL;
+  }
+  unsigned char* token = op++;
+  *token = (unsigned char)((num_literals < 15 ? num_literals : 15) << 4);
+  if (num_literals >= 15) {
+    op = tensor_lz_write_length(op, num_literals - 15);
+  }
+  memcpy(op, literals, num_literals);
+  op += num_literals;
+  if (offset == 0) {
+    return op;
+  }
+  *op++ = (unsigned char)(offset & 255);
+  *op++ = (unsigned char)(offset >> 8);
+  *token |= (unsigned char)(code < 15 ? code : 15);
+  if (code >= 15) {
+    op = tensor_lz_write_length(op, code - 15);
+  }
+  return op;
+}
+
+/**
+ * Compresses bytes with a greedy LZ77 codec.
+ *
+ * The output is a series of sequences, each a token holding 4-bit literal
+ * and match lengths, the literals, a 16-bit match offset and the match
+ * length extensions, with the last sequence holding literals only. Matches
+ * are found through a hash table of the last position of each 4-byte
+ * prefix. Blocks are shorter than 64 KiB, so every offset fits in 16 bits.
+ *
+ * @param src The bytes to compress.
+ * @param size The number of bytes to compress.
+ * @param dst The buffer receiving the compressed bytes.
+ * @param capacity The size of the buffer.
+ * @return The number of compressed bytes, or 0 if they do not fit.
+ */
+static size_t
+tensor_lz_compress(const unsigned char* src,
+                   size_t size,
+                   unsigned char* dst,
+                   size_t capacity)
+{
+  uint32_t table[1 << TENSOR_LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+  unsigned char* op = dst;
+  const unsigned char* end = dst + capacity;
+  size_t anchor = 0;
+  size_t ip = 0;
+  size_t misses = 0;
+  while (ip + TENSOR_LZ_MIN_MATCH <= size) {
+    // Look up the last position with the same prefix
+    uint32_t prefix;
+    memcpy(&prefix, src + ip, sizeof(prefix));
+    uint32_t hash = (prefix * 2654435761u) >> (32 - TENSOR_LZ_HASH_BITS);
+    size_t ref = table[hash];
+    table[hash] = (uint32_t)ip + 1;
+    uint32_t candidate = ~prefix;
+    if (ref != 0) {
+      memcpy(&candidate, src + ref - 1, sizeof(candidate));
+    }
+    if (candidate != prefix) {
+      ip += 1 + (misses++ >> TENSOR_LZ_SKIP_SHIFT);
+      continue;
+    }
+
+    // Extend the match and emit it after the pending literals
+    ref--;
+    size_t match = TENSOR_LZ_MIN_MATCH;
+    while (ip + match < size && src[ref + match] == src[ip + match]) {
+      match++;
+    }
+    op = tensor_lz_write_sequence(
+      op, end, src + anchor, ip - anchor, ip - ref, match);
+    if (op == NULL) {
+      return 0;
+    }
+    ip += match;
+    anchor = ip;
+    misses = 0;
+  }
+  op = tensor_lz_write_sequence(op, end, src + anchor, size - anchor, 0, 0);
+  return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+// Read the part of a sequence length that does not fit its token field
+static int
+tensor_lz_read_length(const unsigned char* src,
+                      size_t size,
+                      size_t* ip,
+                      size_t* length)
+{
+  unsigned char byte;
+  do {
+    if (*ip >= size) {
+      return -1;
+    }
+    byte = src[(*ip)++];
+    *length += byte;
+  } while (byte == 255);
+  return 0;
+}
+
+// Decompress bytes produced by tensor_lz_compress, checking every bound so
+// that corrupt input is rejected instead of read or written out of range
+static int
+tensor_lz_decompress(const unsigned char* src,
+                     size_t size,
+                     unsigned char* dst,
+                     size_t capacity)
+{
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < size) {
+    // Copy literals
+    unsigned char token = src[ip++];
+    size_t num_literals = token >> 4;
+    if (num_literals == 15 &&
+        tensor_lz_read_length(src, size, &ip, &num_literals) != 0) {
+      return -1;
+    }
+    if (num_literals > size - ip || num_literals > capacity - op) {
+      return -1;
+    }
+    memcpy(dst + op, src + ip, num_literals);
+    ip += num_literals;
+    op += num_literals;
+    if (ip == size) {
+      break;
+    }
+
+    // Copy match, doubling the copied span of a match that overlaps its
+    // own output, which repeats with a period of the offset
+    if (size - ip < 2) {
+      return -1;
+    }
+    size_t offset = src[ip] | (size_t)src[ip + 1] << 8;
+    ip += 2;
+    size_t match = token & 15;
+    if (match == 15 && tensor_lz_read_length(src, size, &ip, &match) != 0) {
+      return -1;
+    }
+    match += TENSOR_LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || match > capacity - op) {
+      return -1;
+    }
+    for (size_t copied = 0, span = offset; copied < match; span *= 2) {
+      size_t count = match - copied < span ? match - copied : span;
+      memcpy(dst + op + copied, dst + op - offset, count);
+      copied += count;
+    }
+    op += match;
+  }
+  return op == capacity ? 0 : -1;
+}
+
+// Get the number of elements of a block
+static size_t
+tensor_compressed_block_count(const TensorCompressed* compressed, size_t block)
+{
+  size_t remaining = compressed->num_elements - block * TENSOR_COMPRESS_BLOCK;
+  return remaining < TENSOR_COMPRESS_BLOCK ? remaining : TENSOR_COMPRESS_BLOCK;
+}
+
+// Create a compressed tensor header without data
+static TensorCompressed*
+tensor_compressed_create(const size_t* shape, size_t num_dims)
+{
+  size_t num_elements = 1;
+  for (size_t i = 0; i < num_dims; i++) {
+    num_elements *= shape[i];
+  }
+  size_t num_blocks =
+    (num_elements + TENSOR_COMPRESS_BLOCK - 1) / TENSOR_COMPRESS_BLOCK;
+  TensorCompressed* compressed = (TensorCompressed*)malloc(
+    sizeof(TensorCompressed) + (num_dims + num_blocks + 1) * sizeof(size_t));
+  if (compressed == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for compressed tensor\n");
+    return NULL;
+  }
+  compressed->shape = (size_t*)(compressed + 1);
+  compressed->offsets = compressed->shape + num_dims;
+  memcpy(compressed->shape, shape, num_dims * sizeof(size_t));
+  compressed->num_dims = num_dims;
+  compressed->num_elements = num_elements;
+  compressed->num_blocks = num_blocks;
+  compressed->offsets[0] = 0;
+  compressed->data = NULL;
+  return compressed;
+}
+
+// Compress a range of blocks into their slots of the staging buffer
+static void
+tensor_compress_range(void* arg, size_t begin, size_t end)
+{
+  TensorCompressTask* task = (TensorCompressTask*)arg;
+  unsigned char bytes[TENSOR_COMPRESS_BLOCK_BYTES];
+  for (size_t block = begin; block < end; block++) {
+    size_t count = tensor_compressed_block_count(task->compressed, block);
+    size_t size = count * sizeof(tensor_dtype);
+    unsigned char* dst = task->staging + block * TENSOR_COMPRESS_BLOCK_BYTES;
+    tensor_shuffle(task->values + block * TENSOR_COMPRESS_BLOCK, count, bytes);
+
+    // Store the shuffled bytes as they are unless compression pays off
+    size_t length = tensor_lz_compress(bytes, size, dst, size - 1);
+    if (length == 0) {
+      memcpy(dst, bytes, size);
+      length = size;
+    }
+    task->compressed->offsets[block + 1] = length;
+  }
+}
+
+/**
+ * Compresses a tensor into independently decodable blocks.
+ *
+ * Each block of TENSOR_COMPRESS_BLOCK elements is byte-shuffled, so that
+ * the sign and exponent bytes of all its elements are adjacent, and then
+ * compressed with an LZ77 codec. Blocks that do not shrink are stored
+ * shuffled but uncompressed. Blocks are compressed in parallel.
+ *
+ * @param tensor The tensor to compress.
+ * @return A pointer to the compressed tensor, or NULL if an error occurs.
+ */
+TensorCompressed*
+tensor_compress(const Tensor* tensor)
+{
+  // Create new compressed tensor with a staging slot for every block
+  TensorCompressed* compressed =
+    tensor_compressed_create(tensor->shape, tensor->num_dims);
+  if (compressed == NULL) {
+    return NULL;
+  }
+  size_t num_blocks = compressed->num_blocks;
+  compressed->data = (unsigned char*)malloc(
+    num_blocks > 0 ? num_blocks * TENSOR_COMPRESS_BLOCK_BYTES : 1);
+  if (compressed->data == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for compressed tensor\n");
+    free(compressed);
+    return NULL;
+  }
+
+  // Compress blocks
+  TensorCompressTask task = { compressed, tensor->data, NULL,
+                              compressed->data, 0 };
+  thread_pool_parallel_for(num_blocks, 1, tensor_compress_range, &task);
+
+  // Pack blocks in order and release the unused staging space
+  for (size_t block = 0; block < num_blocks; block++) {
+    size_t length = compressed->offsets[block + 1];
+    compressed->offsets[block + 1] = compressed->offsets[block] + length;
+    memmove(compressed->data + compressed->offsets[block],
+            compressed->data + block * TENSOR_COMPRESS_BLOCK_BYTES,
+            length);
+  }
+  size_t size = compressed->offsets[num_blocks];
+  unsigned char* data =
+    (unsigned char*)realloc(compressed->data, size > 0 ? size : 1);
+  if (data != NULL) {
+    compressed->data = data;
+  }
+
+  // Return compressed tensor
+  return compressed;
+}
+
+/**
+ * Decodes one block of a compressed tensor into a scratch buffer.
+ *
+ * Every block holds TENSOR_COMPRESS_BLOCK consecutive elements in memory
+ * order, except the last, which holds the rest. Consumers can stream over
+ * a compressed tensor with a single cache-sized scratch buffer this way.
+ *
+ * @param compressed The compressed tensor.
+ * @param block The index of the block.
+ * @param scratch The buffer of TENSOR_COMPRESS_BLOCK elements to decode into.
+ * @return The number of elements decoded, or 0 if an error occurs.
+ */
+size_t
+tensor_compressed_block(const TensorCompressed* compressed,
+                        size_t block,
+                        tensor_dtype* scratch)
+{
+  // Check if block is valid
+  if (block >= compressed->num_blocks) {
+    fprintf(stderr, "Error: Block is out of bounds\n");
+    return 0;
+  }
+
+  // Decode block, which is stored as is when its length is the raw size
+  size_t count = tensor_compressed_block_count(compressed, block);
+  size_t size = count * sizeof(tensor_dtype);
+  const unsigned char* src = compressed->data + compressed->offsets[block];
+  size_t length = compressed->offsets[block + 1] - compressed->offsets[block];
+  if (length == size) {
+    tensor_unshuffle(src, count, scratch);
+    return count;
+  }
+  unsigned char bytes[TENSOR_COMPRESS_BLOCK_BYTES];
+  if (tensor_lz_decompress(src, length, bytes, size) != 0) {
+    fprintf(stderr, "Error: Compressed block is corrupt\n");
+    return 0;
+  }
+  tensor_unshuffle(bytes, count, scratch);
+  return count;
+}
+
+// Decompress a range of blocks into place
+static void
+tensor_decompress_range(void* arg, size_t begin, size_t end)
+{
+  TensorCompressTask* task = (TensorCompressTask*)arg;
+  for (size_t block = begin; block < end; block++) {
+    if (tensor_compressed_block(task->compressed,
+                                block,
+                                task->result +
+                                  block * TENSOR_COMPRESS_BLOCK) == 0) {
+      atomic_store(&task->failed, 1);
+    }
+  }
+}
+
+// Decompress a whole tensor, decoding blocks in parallel
+Tensor*
+tensor_decompress(const TensorCompressed* compressed)
+{
+  Tensor* result = tensor_create(compressed->shape, compressed->num_dims);
+  if (result == NULL) {
+    return NULL;
+  }
+  TensorCompressTask task = {
+    (TensorCompressed*)compressed, NULL, result->data, NULL, 0
+  };
+  thread_pool_parallel_for(
+    compressed->num_blocks, 1, tensor_decompress_range, &task);
+  if (atomic_load(&task.failed)) {
+    tensor_free(result);
+    return NULL;
+  }
+  return result;
+}
+
+// Free a compressed tensor
+void
+tensor_compressed_free(TensorCompressed* compressed)
+{
+  if (compressed == NULL) {
+    return;
+  }
+  free(compressed->data);
+  free(compressed);
+}
+
+// Get the shape of a compressed tensor
+const size_t*
+tensor_compressed_shape(const TensorCompressed* compressed)
+{
+  return compressed->shape;
+}
+
+// Get the number of dimensions of a compressed tensor
+size_t
+tensor_compressed_num_dims(const TensorCompressed* compressed)
+{
+  return compressed->num_dims;
+}
+
+// Get the number of elements of a compressed tensor
+size_t
+tensor_compressed_num_elements(const TensorCompressed* compressed)
+{
+  return compressed->num_elements;
+}
+
+// Get the number of bytes of compressed data
+size_t
+tensor_compressed_size(const TensorCompressed* compressed)
+{
+  return compressed->offsets[compressed->num_blocks];
+}
+
+// Get the number of blocks of a compressed tensor
+size_t
+tensor_compressed_num_blocks(const TensorCompressed* compressed)
+{
+  return compressed->num_blocks;
+}
+
+// Write a size as a 64-bit word
+static int
+tensor_compress_write_word(FILE* file, uint64_t word)
+{
+  return fwrite(&word, sizeof(word), 1, file) == 1 ? 0 : -1;
+}
+
+// Read a 64-bit word as a size
+static int
+tensor_compress_read_word(FILE* file, size_t* value)
+{
+  uint64_t word;
+  if (fread(&word, sizeof(word), 1, file) != 1 || word > SIZE_MAX) {
+    return -1;
+  }
+  *value = (size_t)word;
+  return 0;
+}
+
+/**
+ * Saves a compressed tensor to a file.
+ *
+ * The file holds a header of 64-bit words in host byte order, with the
+ * magic number, the format version, the block size, the number of
+ * dimensions, the shape and the block offsets, followed by the compressed
+ * blocks exactly as they are held in memory.
+ *
+ * @param compressed The compressed tensor.
+ * @param path The path of the file to write.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_compressed_save(const TensorCompressed* compressed, const char* path)
+{
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Unable to open %s\n", path);
+    return -1;
+  }
+
+  // Write header, offsets and blocks
+  int status = tensor_compress_write_word(file, TENSOR_COMPRESS_MAGIC) |
+               tensor_compress_write_word(file, TENSOR_COMPRESS_VERSION) |
+               tensor_compress_write_word(file, TENSOR_COMPRESS_BLOCK) |
+               tensor_compress_write_word(file, compressed->num_dims);
+  for (size_t i = 0; i < compressed->num_dims; i++) {
+    status |= tensor_compress_write_word(file, compressed->shape[i]);
+  }
+  for (size_t i = 0; i <= compressed->num_blocks; i++) {
+    status |= tensor_compress_write_word(file, compressed->offsets[i]);
+  }
+  size_t size = tensor_compressed_size(compressed);
+  if (fwrite(compressed->data, 1, size, file) != size) {
+    status = -1;
+  }
+  if (fclose(file) != 0 || status != 0) {
+    fprintf(stderr, "Error: Unable to write %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Loads a compressed tensor from a file written by tensor_compressed_save.
+ *
+ * The header and the block offsets are validated, and every block is
+ * checked again when decoded, so a corrupt file is reported as an error.
+ *
+ * @param path The path of the file to read.
+ * @return A pointer to the compressed tensor, or NULL if an error occurs.
+ */
+TensorCompressed*
+tensor_compressed_load(const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Unable to open %s\n", path);
+    return NULL;
+  }
+
+  // Read and check header
+  size_t header[4];
+  size_t shape[TENSOR_MAX_DIMS];
+  int status = 0;
+  for (size_t i = 0; i < 4; i++) {
+    status |= tensor_compress_read_word(file, &header[i]);
+  }
+  if (status != 0 || header[0] != TENSOR_COMPRESS_MAGIC ||
+      header[1] != TENSOR_COMPRESS_VERSION ||
+      header[2] != TENSOR_COMPRESS_BLOCK || header[3] > TENSOR_MAX_DIMS) {
+    fprintf(stderr, "Error: Invalid compressed tensor file %s\n", path);
+    fclose(file);
+    return NULL;
+  }
+  size_t num_elements = 1;
+  for (size_t i = 0; i < header[3]; i++) {
+    status |= tensor_compress_read_word(file, &shape[i]);
+    if (status == 0 && shape[i] != 0 &&
+        num_elements > SIZE_MAX / sizeof(tensor_dtype) / shape[i]) {
+      status = -1;
+    }
+    num_elements *= status == 0 ? shape[i] : 1;
+  }
+  TensorCompressed* compressed =
+    status == 0 ? tensor_compressed_create(shape, header[3]) : NULL;
+  if (compressed == NULL) {
+    fprintf(stderr, "Error: Invalid compressed tensor file %s\n", path);
+    fclose(file);
+    return NULL;
+  }
+
+  // Read offsets, checking that no block exceeds its raw size
+  for (size_t i = 0; i <= compressed->num_blocks; i++) {
+    status |= tensor_compress_read_word(file, &compressed->offsets[i]);
+    if (status == 0 && i == 0 && compressed->offsets[0] != 0) {
+      status = -1;
+    }
+    if (status == 0 && i > 0 &&
+        (compressed->offsets[i] <= compressed->offsets[i - 1] ||
+         compressed->offsets[i] - compressed->offsets[i - 1] >
+           tensor_compressed_block_count(compressed, i - 1) *
+             sizeof(tensor_dtype))) {
+      status = -1;
+    }
+  }
+
+  // Read blocks
+  size_t size = status == 0 ? tensor_compressed_size(compressed) : 0;
+  compressed->data = (unsigned char*)malloc(size > 0 ? size : 1);
+  if (status != 0 || compressed->data == NULL ||
+      fread(compressed->data, 1, size, file) != size) {
+    fprintf(stderr, "Error: Invalid compressed tensor file %s\n", path);
+    tensor_compressed_free(compressed);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  return compressed;
+}
+
+/**
+ * Computes the sum of a compressed tensor along an axis.
+ *
+ * Blocks are decoded one at a time into a scratch buffer and added into the
+ * result as they stream past, so the decompressed tensor is never held in
+ * memory. Elements are added in the same order as tensor_sum, so the result
+ * is identical to summing the decompressed tensor.
+ *
+ * @param compressed The compressed tensor.
+ * @param axis The axis to sum along.
+ * @return A pointer to the new tensor, or NULL if an error occurs.
+ */
+Tensor*
+tensor_compressed_sum(const TensorCompressed* compressed, size_t axis)
+{
+  // Check if axis is valid
+  if (axis >= compressed->num_dims) {
+    fprintf(stderr, "Error: Axis is out of bounds\n");
+    return NULL;
+  }
+
+  // Create new tensor without the reduced axis
+  size_t shape[TENSOR_MAX_DIMS];
+  size_t inner = 1;
+  for (size_t i = 0, j = 0; i < compressed->num_dims; i++) {
+    if (i != axis) {
+      shape[j++] = compressed->shape[i];
+    }
+    if (i < axis) {
+      inner *= compressed->shape[i];
+    }
+  }
+  Tensor* result = tensor_zeros(shape, compressed->num_dims - 1);
+  if (result == NULL) {
+    return NULL;
+  }
+
+  // Add each decoded block in runs of contiguous result elements
+  tensor_dtype scratch[TENSOR_COMPRESS_BLOCK];
+  size_t length = compressed->shape[axis];
+  size_t i = 0;
+  size_t k = 0;
+  tensor_dtype* base = result->data;
+  for (size_t block = 0; block < compressed->num_blocks; block++) {
+    size_t count = tensor_compressed_block(compressed, block, scratch);
+    if (count == 0) {
+      tensor_free(result);
+      return NULL;
+    }
+    for (size_t j = 0; j < count;) {
+      size_t run = inner - i < count - j ? inner - i : count - j;
+      for (size_t r = 0; r < run; r++) {
+        base[i + r] += scratch[j + r];
+      }
+      j += run;
+      i += run;
+      if (i == inner) {
+        i = 0;
+        if (++k == length) {
+          k = 0;
+          base += inner;
+        }
+      }
+    }
+  }
+
+  // Return sum along axis
+  return result;
+}
@@ -0,0 +1,772 @@
+// Includes
+#include "../includes/einsum.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of distinct subscript letters, a-z then A-Z
+#define TENSOR_EINSUM_NUM_LETTERS 52
+
+// Longest spec whose plan is cached
+#define TENSOR_EINSUM_MAX_SPEC 128
+
+// Number of cached contraction plans
+#define TENSOR_EINSUM_CACHE_SIZE 32
+
+// Largest operand count searched exhaustively for the optimal path
+#define TENSOR_EINSUM_MAX_EXHAUSTIVE 10
+
+// Pairwise contraction of two intermediate results
+typedef struct
+{
+  size_t left;
+  size_t right;
+  uint64_t keep;
+} TensorEinsumStep;
+
+// Parsed spec and contraction path for one spec and set of operand shapes
+typedef struct
+{
+  char spec[TENSOR_EINSUM_MAX_SPEC];
+  size_t num_operands;
+  size_t num_dims[TENSOR_EINSUM_MAX_OPERANDS];
+  size_t shapes[TENSOR_EINSUM_MAX_OPERANDS][TENSOR_MAX_DIMS];
+  unsigned char terms[TENSOR_EINSUM_MAX_OPERANDS][TENSOR_MAX_DIMS];
+  unsigned char output[TENSOR_MAX_DIMS];
+  size_t output_len;
+  uint64_t output_mask;
+  TensorEinsumStep steps[TENSOR_EINSUM_MAX_OPERANDS];
+  size_t num_steps;
+  unsigned long stamp;
+} TensorEinsumPlan;
+
+// Plan cache, evicting the least recently used plan
+static pthread_mutex_t tensor_einsum_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TensorEinsumPlan tensor_einsum_cache[TENSOR_EINSUM_CACHE_SIZE];
+static unsigned long tensor_einsum_clock = 0;
+
+// Map a subscript character to a letter index, or -1 if it is not a letter
+static int
+tensor_einsum_letter(char c)
+{
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a';
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return 26 + (c - 'A');
+  }
+  return -1;
+}
+
+// Compute the number of elements spanned by a set of letters
+static double
+tensor_einsum_volume(uint64_t mask, const size_t* sizes)
+{
+  double volume = 1;
+  for (size_t letter = 0; letter < TENSOR_EINSUM_NUM_LETTERS; letter++) {
+    if (mask >> letter & 1) {
+      volume *= (double)sizes[letter];
+    }
+  }
+  return volume;
+}
+
+/**
+ * Parses a spec against the operands into a plan without a path.
+ *
+ * Letters are case sensitive and spaces are ignored. Without "->" the output
+ * is every letter used exactly once, in alphabetical order.
+ *
+ * @param plan The plan to fill.
+ * @param spec The einsum spec.
+ * @param operands The operands.
+ * @param num_operands The number of operands.
+ * @param sizes Receives the extent of every letter.
+ * @return 0 on success, or -1 if the spec does not match the operands.
+ */
+static int
+tensor_einsum_parse(TensorEinsumPlan* plan,
+                    const char* spec,
+                    const Tensor* const* operands,
+                    size_t num_operands,
+                    size_t* sizes)
+{
+  size_t counts[TENSOR_EINSUM_NUM_LETTERS] = { 0 };
+  for (size_t letter = 0; letter < TENSOR_EINSUM_NUM_LETTERS; letter++) {
+    sizes[letter] = 0;
+  }
+  plan->num_operands = num_operands;
+
+  // Parse the input terms
+  const char* c = spec;
+  size_t term = 0;
+  size_t length = 0;
+  for (;; c++) {
+    if (*c == ' ') {
+      continue;
+    }
+    if (*c == ',' || *c == '\0' || (*c == '-' && c[1] == '>')) {
+      if (term >= num_operands || length != operands[term]->num_dims) {
+        return -1;
+      }
+      plan->num_dims[term++] = length;
+      length = 0;
+      if (*c != ',') {
+        break;
+      }
+      continue;
+    }
+    int letter = tensor_einsum_letter(*c);
+    if (letter < 0 || term >= num_operands ||
+        length >= operands[term]->num_dims) {
+      return -1;
+    }
+    size_t size = operands[term]->shape[length];
+    if (counts[letter] > 0 && sizes[letter] != size) {
+      return -1;
+    }
+    sizes[letter] = size;
+    counts[letter]++;
+    plan->shapes[term][length] = size;
+    plan->terms[term][length++] = (unsigned char)letter;
+  }
+  if (term != num_operands) {
+    return -1;
+  }
+
+  // Parse or infer the output term
+  plan->output_len = 0;
+  plan->output_mask = 0;
+  if (*c == '-') {
+    for (c += 2; *c != '\0'; c++) {
+      if (*c == ' ') {
+        continue;
+      }
+      int letter = tensor_einsum_letter(*c);
+      if (letter < 0 || counts[letter] == 0 ||
+          plan->output_mask >> letter & 1 ||
+          plan->output_len >= TENSOR_MAX_DIMS) {
+        return -1;
+      }
+      plan->output[plan->output_len++] = (unsigned char)letter;
+      plan->output_mask |= (uint64_t)1 << letter;
+    }
+  } else {
+    for (size_t letter = 0; letter < TENSOR_EINSUM_NUM_LETTERS; letter++) {
+      if (counts[letter] == 1) {
+        if (plan->output_len >= TENSOR_MAX_DIMS) {
+          return -1;
+        }
+        plan->output[plan->output_len++] = (unsigned char)letter;
+        plan->output_mask |= (uint64_t)1 << letter;
+      }
+    }
+  }
+  return 0;
+}
+
+// Letters of an operand subset still needed once the subset is contracted
+static uint64_t
+tensor_einsum_needed(uint32_t subset,
+                     const uint64_t* masks,
+                     size_t num_operands,
+                     uint64_t output_mask)
+{
+  uint64_t inside = 0;
+  uint64_t outside = output_mask;
+  for (size_t i = 0; i < num_operands; i++) {
+    if (subset >> i & 1) {
+      inside |= masks[i];
+    } else {
+      outside |= masks[i];
+    }
+  }
+  return inside & outside;
+}
+
+// Append the steps contracting a subset in post-order and return its id
+static size_t
+tensor_einsum_emit(TensorEinsumPlan* plan,
+                   uint32_t subset,
+                   const uint32_t* splits,
+                   const uint64_t* masks)
+{
+  if ((subset & (subset - 1)) == 0) {
+    size_t operand = 0;
+    while (!(subset >> operand & 1)) {
+      operand++;
+    }
+    return operand;
+  }
+  uint32_t left = splits[subset];
+  size_t left_id = tensor_einsum_emit(plan, left, splits, masks);
+  size_t right_id = tensor_einsum_emit(plan, subset & ~left, splits, masks);
+  TensorEinsumStep* step = &plan->steps[plan->num_steps];
+  step->left = left_id;
+  step->right = right_id;
+  step->keep = tensor_einsum_needed(
+    subset, masks, plan->num_operands, plan->output_mask);
+  return plan->num_operands + plan->num_steps++;
+}
+
+/**
+ * Chooses the pairwise contraction order of a plan.
+ *
+ * The cost of a contraction is the number of multiply-adds it performs, which
+ * is the volume of the union of the letters of its two inputs. Up to
+ * TENSOR_EINSUM_MAX_EXHAUSTIVE operands, dynamic programming over operand
+ * subsets finds the order with the lowest total cost. Beyond that, the
+ * cheapest available pair is contracted greedily.
+ *
+ * @param plan The plan, with its terms parsed.
+ * @param sizes The extent of every letter.
+ * @return 0 on success, or -1 if memory allocation fails.
+ */
+static int
+tensor_einsum_optimize(TensorEinsumPlan* plan, const size_t* sizes)
+{
+  size_t n = plan->num_operands;
+  uint64_t masks[TENSOR_EINSUM_MAX_OPERANDS];
+  for (size_t i = 0; i < n; i++) {
+    masks[i] = 0;
+    for (size_t d = 0; d < plan->num_dims[i]; d++) {
+      masks[i] |= (uint64_t)1 << plan->terms[i][d];
+    }
+  }
+  plan->num_steps = 0;
+  if (n == 1) {
+    return 0;
+  }
+
+  // Greedy pairing for large operand counts
+  if (n > TENSOR_EINSUM_MAX_EXHAUSTIVE) {
+    size_t ids[TENSOR_EINSUM_MAX_OPERANDS];
+    uint32_t subsets[TENSOR_EINSUM_MAX_OPERANDS];
+    for (size_t i = 0; i < n; i++) {
+      ids[i] = i;
+      subsets[i] = (uint32_t)1 << i;
+    }
+    for (size_t remaining = n; remaining > 1; remaining--) {
+      size_t best_i = 0, best_j = 1;
+      double best_cost = -1;
+      for (size_t i = 0; i < remaining; i++) {
+        for (size_t j = i + 1; j < remaining; j++) {
+          uint64_t letters =
+            tensor_einsum_needed(subsets[i], masks, n, plan->output_mask) |
+            tensor_einsum_needed(subsets[j], masks, n, plan->output_mask);
+          double cost = tensor_einsum_volume(letters, sizes);
+          if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            best_i = i;
+            best_j = j;
+          }
+        }
+      }
+      uint32_t merged = subsets[best_i] | subsets[best_j];
+      TensorEinsumStep* step = &plan->steps[plan->num_steps];
+      step->left = ids[best_i];
+      step->right = ids[best_j];
+      step->keep = tensor_einsum_needed(merged, masks, n, plan->output_mask);
+      ids[best_i] = n + plan->num_steps++;
+      subsets[best_i] = merged;
+      ids[best_j] = ids[remaining - 1];
+      subsets[best_j] = subsets[remaining - 1];
+    }
+    return 0;
+  }
+
+  // Optimal order by dynamic programming over operand subsets
+  size_t num_subsets = (size_t)1 << n;
+  double* costs = (double*)malloc(num_subsets * sizeof(double));
+  uint32_t* splits = (uint32_t*)malloc(num_subsets * sizeof(uint32_t));
+  uint64_t* needed = (uint64_t*)malloc(num_subsets * sizeof(uint64_t));
+  if (costs == NULL || splits == NULL || needed == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for einsum path\n");
+    free(costs);
+    free(splits);
+    free(needed);
+    return -1;
+  }
+  for (uint32_t subset = 1; subset < num_subsets; subset++) {
+    needed[subset] =
+      tensor_einsum_needed(subset, masks, n, plan->output_mask);
+    if ((subset & (subset - 1)) == 0) {
+      costs[subset] = 0;
+      continue;
+    }
+
+    // Only splits whose left half holds the lowest operand, to halve the work
+    uint32_t lowest = subset & -subset;
+    costs[subset] = -1;
+    for (uint32_t left = (subset - 1) & subset; left > 0;
+         left = (left - 1) & subset) {
+      if (!(left & lowest)) {
+        continue;
+      }
+      uint32_t right = subset & ~left;
+      double cost =
+        costs[left] + costs[right] +
+        tensor_einsum_volume(needed[left] | needed[right], sizes);
+      if (costs[subset] < 0 || cost < costs[subset]) {
+        costs[subset] = cost;
+        splits[subset] = left;
+      }
+    }
+  }
+  tensor_einsum_emit(plan, (uint32_t)(num_subsets - 1), splits, masks);
+  free(costs);
+  free(splits);
+  free(needed);
+  return 0;
+}
+
+// Check if a cached plan was built for the same spec and operand shapes
+static int
+tensor_einsum_matches(const TensorEinsumPlan* plan,
+                      const char* spec,
+                      const Tensor* const* operands,
+                      size_t num_operands)
+{
+  if (plan->stamp == 0 || plan->num_operands != num_operands ||
+      strcmp(plan->spec, spec) != 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < num_operands; i++) {
+    if (plan->num_dims[i] != operands[i]->num_dims) {
+      return 0;
+    }
+    for (size_t d = 0; d < plan->num_dims[i]; d++) {
+      if (plan->shapes[i][d] != operands[i]->shape[d]) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// Look up or build the plan for a spec and operand shapes
+static int
+tensor_einsum_plan(TensorEinsumPlan* plan,
+                   const char* spec,
+                   const Tensor* const* operands,
+                   size_t num_operands)
+{
+  int cacheable = strlen(spec) < TENSOR_EINSUM_MAX_SPEC;
+
+  // Reuse a cached plan
+  if (cacheable) {
+    pthread_mutex_lock(&tensor_einsum_mutex);
+    for (size_t i = 0; i < TENSOR_EINSUM_CACHE_SIZE; i++) {
+      TensorEinsumPlan* cached = &tensor_einsum_cache[i];
+      if (tensor_einsum_matches(cached, spec, operands, num_operands)) {
+        cached->stamp = ++tensor_einsum_clock;
+        *plan = *cached;
+        pthread_mutex_unlock(&tensor_einsum_mutex);
+        return 0;
+      }
+    }
+    pthread_mutex_unlock(&tensor_einsum_mutex);
+  }
+
+  // Build a new plan
+  size_t sizes[TENSOR_EINSUM_NUM_LETTERS];
+  if (tensor_einsum_parse(plan, spec, operands, num_operands, sizes) != 0) {
+    fprintf(stderr, "Error: Einsum spec does not match the operands\n");
+    return -1;
+  }
+  if (tensor_einsum_optimize(plan, sizes) != 0) {
+    return -1;
+  }
+  if (!cacheable) {
+    return 0;
+  }
+
+  // Cache it in place of the least recently used plan
+  strcpy(plan->spec, spec);
+  pthread_mutex_lock(&tensor_einsum_mutex);
+  TensorEinsumPlan* victim = &tensor_einsum_cache[0];
+  for (size_t i = 1; i < TENSOR_EINSUM_CACHE_SIZE; i++) {
+    if (tensor_einsum_cache[i].stamp < victim->stamp) {
+      victim = &tensor_einsum_cache[i];
+    }
+  }
+  plan->stamp = ++tensor_einsum_clock;
+  *victim = *plan;
+  pthread_mutex_unlock(&tensor_einsum_mutex);
+  return 0;
+}
+
+// Drop all cached einsum contraction plans
+void
+tensor_einsum_clear_cache(void)
+{
+  pthread_mutex_lock(&tensor_einsum_mutex);
+  for (size_t i = 0; i < TENSOR_EINSUM_CACHE_SIZE; i++) {
+    tensor_einsum_cache[i].stamp = 0;
+  }
+  pthread_mutex_unlock(&tensor_einsum_mutex);
+}
+
+/**
+ * Reduces an operand to its distinct letters that are still needed.
+ *
+ * Repeated letters select the diagonal and letters outside needed are summed
+ * out, both in a single strided pass. The kept letters stay in order of first
+ * appearance. When there is nothing to reduce the operand is shared, not
+ * copied.
+ *
+ * @param tensor The operand.
+ * @param letters The letters of the operand.
+ * @param needed The set of letters to keep.
+ * @param result_letters Receives the letters of the result.
+ * @param result_len Receives the number of letters of the result.
+ * @return The reduced operand, or NULL on error.
+ */
+static Tensor*
+tensor_einsum_reduce(const Tensor* tensor,
+                     const unsigned char* letters,
+                     uint64_t needed,
+                     unsigned char* result_letters,
+                     size_t* result_len)
+{
+  // Group positions by distinct letter
+  unsigned char unique[TENSOR_MAX_DIMS];
+  size_t shape[TENSOR_MAX_DIMS];
+  size_t strides[TENSOR_MAX_DIMS];
+  size_t num_unique = 0;
+  int trivial = 1;
+  for (size_t d = 0; d < tensor->num_dims; d++) {
+    size_t u = 0;
+    while (u < num_unique && unique[u] != letters[d]) {
+      u++;
+    }
+    if (u == num_unique) {
+      unique[num_unique] = letters[d];
+      shape[num_unique] = tensor->shape[d];
+      strides[num_unique++] = 0;
+    } else {
+      trivial = 0;
+    }
+    strides[u] += tensor->strides[d];
+  }
+  size_t result_shape[TENSOR_MAX_DIMS];
+  *result_len = 0;
+  for (size_t u = 0; u < num_unique; u++) {
+    if (needed >> unique[u] & 1) {
+      result_shape[*result_len] = shape[u];
+      result_letters[(*result_len)++] = unique[u];
+    } else {
+      trivial = 0;
+    }
+  }
+  if (trivial) {
+    return tensor_clone(tensor);
+  }
+
+  // Sum into the result, broadcasting it over dropped letters
+  Tensor* result = tensor_zeros(result_shape, *result_len);
+  if (result == NULL) {
+    return NULL;
+  }
+  size_t out_strides[TENSOR_MAX_DIMS];
+  for (size_t u = 0, r = 0; u < num_unique; u++) {
+    out_strides[u] = needed >> unique[u] & 1 ? result->strides[r++] : 0;
+  }
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   shape,
+                   num_unique,
+                   2,
+                   (const size_t* const[]){ strides, out_strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t src_stride = iter.inner_strides[0];
+    size_t dst_stride = iter.inner_strides[1];
+    for (size_t i = 0; i < iter.inner_size; i++) {
+      dst[i * dst_stride] += src[i * src_stride];
+    }
+  }
+  return result;
+}
+
+// Permute a tensor and view it with a new shape, sharing data when possible
+static Tensor*
+tensor_einsum_arrange(const Tensor* tensor,
+                      const size_t* axes,
+                      const size_t* shape,
+                      size_t num_dims)
+{
+  int identity = 1;
+  for (size_t d = 0; d < tensor->num_dims; d++) {
+    identity &= axes[d] == d;
+  }
+  Tensor* permuted =
+    identity ? tensor_clone(tensor) : tensor_permute(tensor, axes);
+  if (permuted == NULL) {
+    return NULL;
+  }
+  Tensor* result = tensor_reshape(permuted, shape, num_dims);
+  tensor_free(permuted);
+  return result;
+}
+
+/**
+ * Contracts two reduced operands with a single batched GEMM.
+ *
+ * Letters in both operands are batch letters when still needed and are
+ * contracted otherwise; the rest are free letters of one side. Each operand
+ * is permuted into a (free, contracted, batch) or (contracted, free, batch)
+ * matrix stack and the product is viewed with the letters
+ * left free, right free, batch.
+ *
+ * @param left The left operand.
+ * @param left_letters The letters of the left operand.
+ * @param right The right operand.
+ * @param right_letters The letters of the right operand.
+ * @param keep The set of letters needed after the contraction.
+ * @param result_letters Receives the letters of the result.
+ * @param result_len Receives the number of letters of the result.
+ * @return The contraction, or NULL on error.
+ */
+static Tensor*
+tensor_einsum_contract(const Tensor* left,
+                       const unsigned char* left_letters,
+                       const Tensor* right,
+                       const unsigned char* right_letters,
+                       uint64_t keep,
+                       unsigned char* result_letters,
+                       size_t* result_len)
+{
+  uint64_t right_mask = 0;
+  for (size_t d = 0; d < right->num_dims; d++) {
+    right_mask |= (uint64_t)1 << right_letters[d];
+  }
+
+  // Classify the left axes
+  size_t free_axes[TENSOR_MAX_DIMS], num_free = 0;
+  size_t contracted_axes[TENSOR_MAX_DIMS], num_contracted = 0;
+  size_t batch_axes[TENSOR_MAX_DIMS], num_batch = 0;
+  size_t m = 1, k = 1, batch = 1;
+  for (size_t d = 0; d < left->num_dims; d++) {
+    uint64_t bit = (uint64_t)1 << left_letters[d];
+    if (!(right_mask & bit)) {
+      free_axes[num_free++] = d;
+      m *= left->shape[d];
+    } else if (keep & bit) {
+      batch_axes[num_batch++] = d;
+      batch *= left->shape[d];
+    } else {
+      contracted_axes[num_contracted++] = d;
+      k *= left->shape[d];
+    }
+  }
+
+  // Match the right axes to the left ones
+  size_t right_axes[TENSOR_MAX_DIMS], num_right = 0;
+  size_t right_free[TENSOR_MAX_DIMS], num_right_free = 0;
+  size_t n = 1;
+  for (size_t i = 0; i < num_contracted; i++) {
+    for (size_t d = 0; d < right->num_dims; d++) {
+      if (right_letters[d] == left_letters[contracted_axes[i]]) {
+        right_axes[num_right++] = d;
+      }
+    }
+  }
+  for (size_t d = 0; d < right->num_dims; d++) {
+    int shared = 0;
+    for (size_t e = 0; e < left->num_dims; e++) {
+      shared |= left_letters[e] == right_letters[d];
+    }
+    if (!shared) {
+      right_free[num_right_free++] = d;
+      right_axes[num_right++] = d;
+      n *= right->shape[d];
+    }
+  }
+  for (size_t i = 0; i < num_batch; i++) {
+    for (size_t d = 0; d < right->num_dims; d++) {
+      if (right_letters[d] == left_letters[batch_axes[i]]) {
+        right_axes[num_right++] = d;
+      }
+    }
+  }
+  if (num_free + num_right_free + num_batch > TENSOR_MAX_DIMS) {
+    fprintf(stderr, "Error: Einsum intermediate has too many dimensions\n");
+    return NULL;
+  }
+
+  // Arrange both operands as matrix stacks
+  size_t left_axes[TENSOR_MAX_DIMS], num_left = 0;
+  for (size_t i = 0; i < num_free; i++) {
+    left_axes[num_left++] = free_axes[i];
+  }
+  for (size_t i = 0; i < num_contracted; i++) {
+    left_axes[num_left++] = contracted_axes[i];
+  }
+  for (size_t i = 0; i < num_batch; i++) {
+    left_axes[num_left++] = batch_axes[i];
+  }
+  Tensor* left_stack =
+    tensor_einsum_arrange(left, left_axes, (size_t[]){ m, k, batch }, 3);
+  Tensor* right_stack =
+    tensor_einsum_arrange(right, right_axes, (size_t[]){ k, n, batch }, 3);
+  Tensor* product = NULL;
+  if (left_stack != NULL && right_stack != NULL) {
+    product = tensor_batch_matmul(left_stack, right_stack);
+  }
+  if (left_stack != NULL) {
+    tensor_free(left_stack);
+  }
+  if (right_stack != NULL) {
+    tensor_free(right_stack);
+  }
+  if (product == NULL) {
+    return NULL;
+  }
+
+  // View the product with its letters
+  size_t shape[TENSOR_MAX_DIMS];
+  *result_len = 0;
+  for (size_t i = 0; i < num_free; i++) {
+    shape[*result_len] = left->shape[free_axes[i]];
+    result_letters[(*result_len)++] = left_letters[free_axes[i]];
+  }
+  for (size_t i = 0; i < num_right_free; i++) {
+    shape[*result_len] = right->shape[right_free[i]];
+    result_letters[(*result_len)++] = right_letters[right_free[i]];
+  }
+  for (size_t i = 0; i < num_batch; i++) {
+    shape[*result_len] = left->shape[batch_axes[i]];
+    result_letters[(*result_len)++] = left_letters[batch_axes[i]];
+  }
+  Tensor* result = tensor_reshape(product, shape, *result_len);
+  tensor_free(product);
+  return result;
+}
+
+/**
+ * Computes an Einstein summation such as "ij,jk->ik" over the operands.
+ *
+ * The spec is parsed and a cost-optimal pairwise contraction order is chosen
+ * once per spec and set of operand shapes, then cached. Every contraction is
+ * lowered to permutations and a batched GEMM; diagonals and letters used by a
+ * single operand are reduced in one strided pass before they reach the GEMM.
+ *
+ * @param spec The einsum spec, with one term per operand.
+ * @param operands The operands.
+ * @param num_operands The number of operands.
+ * @return A pointer to the result, or NULL on error.
+ */
+Tensor*
+tensor_einsum(const char* spec,
+              const Tensor* const* operands,
+              size_t num_operands)
+{
+  // Check if number of operands is supported
+  if (num_operands == 0 || num_operands > TENSOR_EINSUM_MAX_OPERANDS) {
+    fprintf(stderr, "Error: Einsum has an unsupported number of operands\n");
+    return NULL;
+  }
+
+  // Get the contraction plan
+  TensorEinsumPlan plan;
+  if (tensor_einsum_plan(&plan, spec, operands, num_operands) != 0) {
+    return NULL;
+  }
+
+  // Intermediates are indexed by id: operands first, then step results
+  Tensor* items[2 * TENSOR_EINSUM_MAX_OPERANDS] = { NULL };
+  unsigned char letters[2 * TENSOR_EINSUM_MAX_OPERANDS][TENSOR_MAX_DIMS];
+  size_t lengths[2 * TENSOR_EINSUM_MAX_OPERANDS];
+  for (size_t i = 0; i < num_operands; i++) {
+    memcpy(letters[i], plan.terms[i], plan.num_dims[i]);
+    lengths[i] = plan.num_dims[i];
+  }
+
+  // Run the contractions
+  size_t last = 0;
+  int failed = 0;
+  for (size_t s = 0; s < plan.num_steps && !failed; s++) {
+    const TensorEinsumStep* step = &plan.steps[s];
+    size_t ids[2] = { step->left, step->right };
+    Tensor* reduced[2] = { NULL, NULL };
+    unsigned char reduced_letters[2][TENSOR_MAX_DIMS];
+    size_t reduced_lengths[2];
+    for (size_t side = 0; side < 2; side++) {
+      size_t id = ids[side];
+      size_t other = ids[1 - side];
+      uint64_t needed = step->keep;
+      for (size_t d = 0; d < lengths[other]; d++) {
+        needed |= (uint64_t)1 << letters[other][d];
+      }
+      const Tensor* input = id < num_operands ? operands[id] : items[id];
+      reduced[side] = tensor_einsum_reduce(input,
+                                           letters[id],
+                                           needed,
+                                           reduced_letters[side],
+                                           &reduced_lengths[side]);
+    }
+    last = num_operands + s;
+    if (reduced[0] != NULL && reduced[1] != NULL) {
+      items[last] = tensor_einsum_contract(reduced[0],
+                                           reduced_letters[0],
+                                           reduced[1],
+                                           reduced_letters[1],
+                                           step->keep,
+                                           letters[last],
+                                           &lengths[last]);
+    }
+    failed = items[last] == NULL;
+    for (size_t side = 0; side < 2; side++) {
+      if (reduced[side] != NULL) {
+        tensor_free(reduced[side]);
+      }
+      if (ids[side] >= num_operands) {
+        tensor_free(items[ids[side]]);
+        items[ids[side]] = NULL;
+      }
+    }
+  }
+  if (failed) {
+    for (size_t i = num_operands; i < 2 * TENSOR_EINSUM_MAX_OPERANDS; i++) {
+      if (items[i] != NULL) {
+        tensor_free(items[i]);
+      }
+    }
+    return NULL;
+  }
+
+  // Reduce to the output letters and put them in output order
+  const Tensor* final = plan.num_steps == 0 ? operands[0] : items[last];
+  unsigned char final_letters[TENSOR_MAX_DIMS];
+  size_t final_len;
+  Tensor* reduced = tensor_einsum_reduce(
+    final, letters[last], plan.output_mask, final_letters, &final_len);
+  if (plan.num_steps > 0) {
+    tensor_free(items[last]);
+  }
+  if (reduced == NULL) {
+    return NULL;
+  }
+  size_t axes[TENSOR_MAX_DIMS];
+  for (size_t i = 0; i < plan.output_len; i++) {
+    for (size_t d = 0; d < final_len; d++) {
+      if (final_letters[d] == plan.output[i]) {
+        axes[i] = d;
+      }
+    }
+  }
+  int identity = 1;
+  for (size_t i = 0; i < plan.output_len; i++) {
+    identity &= axes[i] == i;
+  }
+  if (identity) {
+    return reduced;
+  }
+  Tensor* result = tensor_permute(reduced, axes);
+  tensor_free(reduced);
+  return result;
+}
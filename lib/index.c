@@ -0,0 +1,515 @@
+// Includes
+#include "../includes/index.h"
+#include "../includes/thread_pool.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of elements copied or accumulated per parallel chunk
+#define TENSOR_INDEX_GRAIN 16384
+
+// Number of indexed slices to prefetch ahead of the one being read
+#define TENSOR_INDEX_PREFETCH 8
+
+// Number of leading bytes of a slice to prefetch, past which the hardware
+// prefetcher follows the sequential access by itself
+#define TENSOR_INDEX_PREFETCH_BYTES 512
+
+// Number of contiguous columns owned by one scatter task
+#define TENSOR_INDEX_BLOCK 64
+
+// Maximum number of elements of private scatter accumulators
+#define TENSOR_INDEX_PRIVATE_LIMIT (1 << 24)
+
+// Arguments of a parallel slice copy or reduction by index
+typedef struct
+{
+  const tensor_dtype* src;
+  tensor_dtype* dst;
+  const size_t* indices;
+  size_t num_indices;
+  const size_t* offsets;
+  size_t inner;
+  size_t length;
+  TensorEmbeddingMode mode;
+} TensorIndexSlices;
+
+// Arguments of a parallel gather or scatter along an axis
+typedef struct
+{
+  const tensor_dtype* src;
+  tensor_dtype* dst;
+  const tensor_dtype* index;
+  size_t inner;
+  size_t length;
+  size_t count;
+  size_t outer;
+  size_t num_blocks;
+  size_t chunk;
+  tensor_dtype* private;
+} TensorIndexScatter;
+
+// Prefetch the leading cache lines of a slice about to be read
+static inline void
+tensor_index_prefetch(const tensor_dtype* slice, size_t count)
+{
+  size_t bytes = count * sizeof(tensor_dtype);
+  if (bytes > TENSOR_INDEX_PREFETCH_BYTES) {
+    bytes = TENSOR_INDEX_PREFETCH_BYTES;
+  }
+  for (size_t byte = 0; byte < bytes; byte += 64) {
+    __builtin_prefetch((const char*)slice + byte, 0, 0);
+  }
+}
+
+// Check that every index is below a bound
+static int
+tensor_index_check(const size_t* indices, size_t num_indices, size_t bound)
+{
+  for (size_t i = 0; i < num_indices; i++) {
+    if (indices[i] >= bound) {
+      fprintf(stderr, "Error: Index is out of bounds\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Check that an index tensor holds integers below a bound
+static int
+tensor_index_check_tensor(const Tensor* index, size_t bound)
+{
+  for (size_t i = 0; i < index->num_elements; i++) {
+    tensor_dtype value = index->data[i];
+    if (!(value >= 0 && value < (tensor_dtype)bound) || value != floor(value)) {
+      fprintf(stderr, "Error: Index is out of bounds\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Check that an index tensor matches a tensor on every axis but one
+static int
+tensor_index_check_shape(const Tensor* tensor,
+                         size_t axis,
+                         const Tensor* index)
+{
+  if (axis >= tensor->num_dims) {
+    fprintf(stderr, "Error: Axis is out of bounds\n");
+    return -1;
+  }
+  if (index->num_dims != tensor->num_dims) {
+    fprintf(stderr, "Error: Index is not compatible with tensor\n");
+    return -1;
+  }
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    if (i != axis && index->shape[i] != tensor->shape[i]) {
+      fprintf(stderr, "Error: Index is not compatible with tensor\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Copy a range of selected slices, each of inner contiguous elements
+static void
+tensor_index_select_range(void* arg, size_t begin, size_t end)
+{
+  TensorIndexSlices* select = (TensorIndexSlices*)arg;
+  size_t inner = select->inner;
+  for (size_t item = begin; item < end; item++) {
+    size_t o = item / select->num_indices;
+    size_t k = item % select->num_indices;
+    if (item + TENSOR_INDEX_PREFETCH < end) {
+      size_t ahead = item + TENSOR_INDEX_PREFETCH;
+      tensor_index_prefetch(
+        select->src + (ahead / select->num_indices * select->length +
+                       select->indices[ahead % select->num_indices]) *
+                        inner,
+        inner);
+    }
+    memcpy(select->dst + item * inner,
+           select->src + (o * select->length + select->indices[k]) * inner,
+           inner * sizeof(tensor_dtype));
+  }
+}
+
+/**
+ * Selects slices of a tensor along an axis by index.
+ *
+ * The result has the tensor's shape with the axis resized to num_indices,
+ * and its k-th slice along the axis is the tensor's slice indices[k]. Each
+ * slice is a run of contiguous elements, copied in parallel with the slices
+ * a few indices ahead prefetched, so large tables are read at full speed
+ * even when the indices are random.
+ *
+ * @param tensor The tensor to select from.
+ * @param axis The axis to select along.
+ * @param indices The indices of the slices to select.
+ * @param num_indices The number of indices.
+ * @return A pointer to the new tensor, or NULL if an error occurs.
+ */
+Tensor*
+tensor_index_select(const Tensor* tensor,
+                    size_t axis,
+                    const size_t* indices,
+                    size_t num_indices)
+{
+  // Check if axis and indices are valid
+  if (axis >= tensor->num_dims) {
+    fprintf(stderr, "Error: Axis is out of bounds\n");
+    return NULL;
+  }
+  if (tensor_index_check(indices, num_indices, tensor->shape[axis]) != 0) {
+    return NULL;
+  }
+
+  // Create new tensor for selection
+  size_t shape[TENSOR_MAX_DIMS];
+  memcpy(shape, tensor->shape, tensor->num_dims * sizeof(size_t));
+  shape[axis] = num_indices;
+  Tensor* result = tensor_create(shape, tensor->num_dims);
+  if (result == NULL || result->num_elements == 0) {
+    return result;
+  }
+
+  // Copy selected slices
+  TensorIndexSlices select = { tensor->data,
+                               result->data,
+                               indices,
+                               num_indices,
+                               NULL,
+                               tensor->strides[axis],
+                               tensor->shape[axis],
+                               TENSOR_EMBEDDING_SUM };
+  thread_pool_parallel_for(result->num_elements / select.inner,
+                           (TENSOR_INDEX_GRAIN + select.inner - 1) /
+                             select.inner,
+                           tensor_index_select_range,
+                           &select);
+
+  // Return selection
+  return result;
+}
+
+// Gather a range of slices, each reading along the axis at indexed positions
+static void
+tensor_gather_range(void* arg, size_t begin, size_t end)
+{
+  TensorIndexScatter* gather = (TensorIndexScatter*)arg;
+  size_t inner = gather->inner;
+  for (size_t item = begin; item < end; item++) {
+    size_t o = item / gather->count;
+    const tensor_dtype* src = gather->src + o * gather->length * inner;
+    const tensor_dtype* index = gather->index + item * inner;
+    tensor_dtype* dst = gather->dst + item * inner;
+    for (size_t i = 0; i < inner; i++) {
+      dst[i] = src[(size_t)index[i] * inner + i];
+    }
+  }
+}
+
+/**
+ * Gathers elements along an axis at the positions given by an index tensor.
+ *
+ * The index has the tensor's shape except along the axis, and the result has
+ * the index's shape. Each result element is the tensor element at the same
+ * position, with the coordinate along the axis replaced by the index
+ * element there.
+ *
+ * @param tensor The tensor to gather from.
+ * @param axis The axis to gather along.
+ * @param index The positions along the axis, as integral values.
+ * @return A pointer to the new tensor, or NULL if an error occurs.
+ */
+Tensor*
+tensor_gather(const Tensor* tensor, size_t axis, const Tensor* index)
+{
+  // Check if index is valid
+  if (tensor_index_check_shape(tensor, axis, index) != 0 ||
+      tensor_index_check_tensor(index, tensor->shape[axis]) != 0) {
+    return NULL;
+  }
+
+  // Create new tensor for gather
+  Tensor* result = tensor_create(index->shape, index->num_dims);
+  if (result == NULL || result->num_elements == 0) {
+    return result;
+  }
+
+  // Gather along axis
+  size_t inner = tensor->strides[axis];
+  TensorIndexScatter gather = { tensor->data,
+                                result->data,
+                                index->data,
+                                inner,
+                                tensor->shape[axis],
+                                index->shape[axis],
+                                0,
+                                0,
+                                0,
+                                NULL };
+  thread_pool_parallel_for(result->num_elements / inner,
+                           (TENSOR_INDEX_GRAIN + inner - 1) / inner,
+                           tensor_gather_range,
+                           &gather);
+
+  // Return gather
+  return result;
+}
+
+// Scatter into a range of column blocks, each owned by a single task
+static void
+tensor_scatter_blocks(void* arg, size_t begin, size_t end)
+{
+  TensorIndexScatter* scatter = (TensorIndexScatter*)arg;
+  size_t inner = scatter->inner;
+  for (size_t block = begin; block < end; block++) {
+    size_t o = block / scatter->num_blocks;
+    size_t col = block % scatter->num_blocks * TENSOR_INDEX_BLOCK;
+    size_t width =
+      inner - col < TENSOR_INDEX_BLOCK ? inner - col : TENSOR_INDEX_BLOCK;
+    tensor_dtype* dst = scatter->dst + o * scatter->length * inner + col;
+    size_t base = o * scatter->count * inner + col;
+    for (size_t k = 0; k < scatter->count; k++) {
+      const tensor_dtype* src = scatter->src + base + k * inner;
+      const tensor_dtype* index = scatter->index + base + k * inner;
+      for (size_t i = 0; i < width; i++) {
+        dst[(size_t)index[i] * inner + i] += src[i];
+      }
+    }
+  }
+}
+
+// Scatter a range of chunks of a single column into private accumulators
+static void
+tensor_scatter_private(void* arg, size_t begin, size_t end)
+{
+  TensorIndexScatter* scatter = (TensorIndexScatter*)arg;
+  size_t inner = scatter->inner;
+  size_t size = scatter->length * inner;
+  for (size_t chunk = begin; chunk < end; chunk++) {
+    tensor_dtype* dst = scatter->private + chunk * size;
+    size_t first = chunk * scatter->chunk;
+    size_t last = first + scatter->chunk < scatter->count
+                    ? first + scatter->chunk
+                    : scatter->count;
+    memset(dst, 0, size * sizeof(tensor_dtype));
+    for (size_t k = first; k < last; k++) {
+      const tensor_dtype* src = scatter->src + k * inner;
+      const tensor_dtype* index = scatter->index + k * inner;
+      for (size_t i = 0; i < inner; i++) {
+        dst[(size_t)index[i] * inner + i] += src[i];
+      }
+    }
+  }
+}
+
+// Add a range of elements of the private accumulators into the tensor
+static void
+tensor_scatter_merge(void* arg, size_t begin, size_t end)
+{
+  TensorIndexScatter* scatter = (TensorIndexScatter*)arg;
+  size_t size = scatter->length * scatter->inner;
+  size_t num_chunks = (scatter->count + scatter->chunk - 1) / scatter->chunk;
+  for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+    const tensor_dtype* src = scatter->private + chunk * size;
+    for (size_t j = begin; j < end; j++) {
+      scatter->dst[j] += src[j];
+    }
+  }
+}
+
+/**
+ * Adds source elements into a tensor along an axis at indexed positions.
+ *
+ * The index and the source have the same shape, which matches the tensor
+ * except along the axis. Each source element is added to the tensor element
+ * at the same position, with the coordinate along the axis replaced by the
+ * index element there. Duplicate indices accumulate.
+ *
+ * No atomics are needed: the output is partitioned into blocks of contiguous
+ * columns across the other axes, each owned by one task. When the tensor has
+ * only one such block, chunks of the source are instead accumulated into
+ * private copies of the tensor and merged in chunk order. Either way the
+ * order of additions depends only on the shapes, so results are identical
+ * for any number of threads.
+ *
+ * @param tensor The tensor to add into.
+ * @param axis The axis to scatter along.
+ * @param index The positions along the axis, as integral values.
+ * @param source The values to add.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_scatter_add(Tensor* tensor,
+                   size_t axis,
+                   const Tensor* index,
+                   const Tensor* source)
+{
+  // Check if index and source are valid
+  if (tensor_index_check_shape(tensor, axis, index) != 0) {
+    return -1;
+  }
+  if (!tensor_same_shape(index, source)) {
+    fprintf(stderr, "Error: Source is not compatible with index\n");
+    return -1;
+  }
+  if (tensor_index_check_tensor(index, tensor->shape[axis]) != 0 ||
+      tensor_make_writable(tensor) != 0) {
+    return -1;
+  }
+  if (source->num_elements == 0) {
+    return 0;
+  }
+
+  size_t inner = tensor->strides[axis];
+  size_t count = index->shape[axis];
+  size_t outer = source->num_elements / (inner * count);
+  TensorIndexScatter scatter = { source->data,
+                                 tensor->data,
+                                 index->data,
+                                 inner,
+                                 tensor->shape[axis],
+                                 count,
+                                 outer,
+                                 (inner + TENSOR_INDEX_BLOCK - 1) /
+                                   TENSOR_INDEX_BLOCK,
+                                 (TENSOR_INDEX_GRAIN + inner - 1) / inner,
+                                 NULL };
+  size_t num_blocks = outer * scatter.num_blocks;
+  size_t num_chunks = (count + scatter.chunk - 1) / scatter.chunk;
+
+  // Privatize a single block that is long enough to be worth splitting
+  size_t size = scatter.length * inner;
+  if (num_blocks == 1 && num_chunks > 1 &&
+      num_chunks * size <= TENSOR_INDEX_PRIVATE_LIMIT) {
+    scatter.private =
+      (tensor_dtype*)malloc(num_chunks * size * sizeof(tensor_dtype));
+  }
+  if (scatter.private != NULL) {
+    thread_pool_parallel_for(
+      num_chunks, 1, tensor_scatter_private, &scatter);
+    thread_pool_parallel_for(
+      size, TENSOR_INDEX_GRAIN, tensor_scatter_merge, &scatter);
+    free(scatter.private);
+    return 0;
+  }
+
+  // Otherwise give each task whole column blocks
+  size_t block_size =
+    count * (inner < TENSOR_INDEX_BLOCK ? inner : TENSOR_INDEX_BLOCK);
+  thread_pool_parallel_for(num_blocks,
+                           (TENSOR_INDEX_GRAIN + block_size - 1) / block_size,
+                           tensor_scatter_blocks,
+                           &scatter);
+  return 0;
+}
+
+// Reduce a range of bags of embedding columns
+static void
+tensor_embedding_bag_range(void* arg, size_t begin, size_t end)
+{
+  TensorIndexSlices* bag = (TensorIndexSlices*)arg;
+  size_t dim = bag->inner;
+  for (size_t b = begin; b < end; b++) {
+    size_t first = bag->offsets[b];
+    size_t last =
+      b + 1 < bag->length ? bag->offsets[b + 1] : bag->num_indices;
+    tensor_dtype* dst = bag->dst + b * dim;
+    if (first == last) {
+      memset(dst, 0, dim * sizeof(tensor_dtype));
+      continue;
+    }
+    memcpy(
+      dst, bag->src + bag->indices[first] * dim, dim * sizeof(tensor_dtype));
+    for (size_t j = first + 1; j < last; j++) {
+      if (j + TENSOR_INDEX_PREFETCH < bag->num_indices) {
+        tensor_index_prefetch(
+          bag->src + bag->indices[j + TENSOR_INDEX_PREFETCH] * dim, dim);
+      }
+      const tensor_dtype* row = bag->src + bag->indices[j] * dim;
+      if (bag->mode == TENSOR_EMBEDDING_MAX) {
+        for (size_t i = 0; i < dim; i++) {
+          dst[i] = fmax(dst[i], row[i]);
+        }
+      } else {
+        for (size_t i = 0; i < dim; i++) {
+          dst[i] += row[i];
+        }
+      }
+    }
+    if (bag->mode == TENSOR_EMBEDDING_MEAN) {
+      tensor_dtype scale = 1.0 / (tensor_dtype)(last - first);
+      for (size_t i = 0; i < dim; i++) {
+        dst[i] *= scale;
+      }
+    }
+  }
+}
+
+/**
+ * Looks up bags of embedding columns and reduces each bag to one column.
+ *
+ * The weight has shape (dim, num_embeddings), so each embedding is a column
+ * of dim contiguous elements. Bag b holds the embeddings indices[offsets[b]]
+ * up to, but excluding, indices[offsets[b + 1]], with the last bag running
+ * to the end of the indices. The result has shape (dim, num_bags) and an
+ * empty bag gives a zero column. The lookup and the reduction are fused, so
+ * no intermediate of the looked up columns is ever created, and embeddings
+ * a few indices ahead are prefetched.
+ *
+ * @param weight The embedding table.
+ * @param indices The embeddings to look up.
+ * @param num_indices The number of indices.
+ * @param offsets The start of each bag in the indices.
+ * @param num_bags The number of bags.
+ * @param mode The reduction applied to each bag.
+ * @return A pointer to the new tensor, or NULL if an error occurs.
+ */
+Tensor*
+tensor_embedding_bag(const Tensor* weight,
+                     const size_t* indices,
+                     size_t num_indices,
+                     const size_t* offsets,
+                     size_t num_bags,
+                     TensorEmbeddingMode mode)
+{
+  // Check if weight, indices and offsets are valid
+  if (weight->num_dims != 2) {
+    fprintf(stderr, "Error: Embedding weight must have two dimensions\n");
+    return NULL;
+  }
+  if (tensor_index_check(indices, num_indices, weight->shape[1]) != 0) {
+    return NULL;
+  }
+  for (size_t b = 0; b < num_bags; b++) {
+    size_t next = b + 1 < num_bags ? offsets[b + 1] : num_indices;
+    if (offsets[b] > next || next > num_indices) {
+      fprintf(stderr, "Error: Bag offsets are not ordered\n");
+      return NULL;
+    }
+  }
+
+  // Create new tensor for embedding bags
+  size_t shape[2] = { weight->shape[0], num_bags };
+  Tensor* result = tensor_create(shape, 2);
+  if (result == NULL || result->num_elements == 0) {
+    return result;
+  }
+
+  // Reduce each bag
+  size_t dim = weight->shape[0];
+  size_t per_bag = dim * (num_indices / num_bags + 1);
+  TensorIndexSlices bag = { weight->data, result->data, indices, num_indices,
+                            offsets,      dim,          num_bags, mode };
+  thread_pool_parallel_for(num_bags,
+                           (TENSOR_INDEX_GRAIN + per_bag - 1) / per_bag,
+                           tensor_embedding_bag_range,
+                           &bag);
+
+  // Return embedding bags
+  return result;
+}
@@ -0,0 +1,724 @@
+// Includes
+#include "../includes/plan.h"
+#include "../includes/kernels.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Alignment of intermediates in the arena, in elements of one cache line
+#define TENSOR_PLAN_ALIGN (64 / sizeof(tensor_dtype))
+
+// Maximum number of operands of a captured operation
+#define TENSOR_PLAN_MAX_OPERANDS 3
+
+// Role of a value in a plan
+typedef enum
+{
+  TENSOR_PLAN_VALUE_INPUT,
+  TENSOR_PLAN_VALUE_INTERMEDIATE,
+  TENSOR_PLAN_VALUE_OUTPUT
+} TensorPlanKind;
+
+// Kind of a captured operation
+typedef enum
+{
+  TENSOR_PLAN_STEP_GEMM,
+  TENSOR_PLAN_STEP_BINARY,
+  TENSOR_PLAN_STEP_ACTIVATION,
+  TENSOR_PLAN_STEP_SCALE,
+  TENSOR_PLAN_STEP_REDUCE
+} TensorPlanStepKind;
+
+// Value flowing between operations, with its lifetime in steps
+typedef struct
+{
+  size_t shape[TENSOR_MAX_DIMS];
+  size_t num_dims;
+  size_t num_elements;
+  TensorPlanKind kind;
+  size_t first;
+  size_t last;
+  size_t offset;
+  tensor_dtype* data;
+} TensorPlanValue;
+
+// Operation with its operands and parameters resolved at capture time
+typedef struct
+{
+  TensorPlanStepKind kind;
+  size_t operands[TENSOR_PLAN_MAX_OPERANDS];
+  size_t num_operands;
+  size_t result;
+  int op;
+  TensorActivation activation;
+  tensor_dtype scalar;
+  size_t dims[3];
+} TensorPlanStep;
+
+// Plan definition
+struct TensorPlan
+{
+  TensorPlanValue* values;
+  size_t num_values;
+  size_t value_capacity;
+  TensorPlanStep* steps;
+  size_t num_steps;
+  size_t step_capacity;
+  size_t* inputs;
+  size_t num_inputs;
+  size_t input_capacity;
+  size_t* outputs;
+  Tensor** results;
+  size_t num_outputs;
+  size_t output_capacity;
+  tensor_dtype* arena;
+  size_t arena_elements;
+  int compiled;
+};
+
+// Create an empty plan
+TensorPlan*
+tensor_plan_create(void)
+{
+  TensorPlan* plan = (TensorPlan*)calloc(1, sizeof(TensorPlan));
+  if (plan == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for plan\n");
+  }
+  return plan;
+}
+
+// Free the output tensors of a plan
+static void
+tensor_plan_free_results(TensorPlan* plan)
+{
+  for (size_t i = 0; plan->results != NULL && i < plan->num_outputs; i++) {
+    if (plan->results[i] != NULL) {
+      tensor_free(plan->results[i]);
+    }
+  }
+  free(plan->results);
+  plan->results = NULL;
+}
+
+// Free a plan, its arena and its outputs
+void
+tensor_plan_free(TensorPlan* plan)
+{
+  if (plan == NULL) {
+    return;
+  }
+  tensor_plan_free_results(plan);
+  free(plan->values);
+  free(plan->steps);
+  free(plan->inputs);
+  free(plan->outputs);
+  free(plan->arena);
+  free(plan);
+}
+
+// Grow an array of a plan to hold one more entry
+static int
+tensor_plan_reserve(void** array, size_t count, size_t* capacity, size_t size)
+{
+  if (count < *capacity) {
+    return 0;
+  }
+  size_t grown = *capacity > 0 ? 2 * *capacity : 8;
+  void* resized = realloc(*array, grown * size);
+  if (resized == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for plan\n");
+    return -1;
+  }
+  *array = resized;
+  *capacity = grown;
+  return 0;
+}
+
+// Add a value of the given shape to a plan
+static size_t
+tensor_plan_add_value(TensorPlan* plan,
+                      const size_t* shape,
+                      size_t num_dims,
+                      TensorPlanKind kind)
+{
+  if (plan->compiled) {
+    fprintf(stderr, "Error: Plan is already compiled\n");
+    return TENSOR_PLAN_INVALID;
+  }
+  if (num_dims > TENSOR_MAX_DIMS) {
+    fprintf(stderr, "Error: Too many dimensions\n");
+    return TENSOR_PLAN_INVALID;
+  }
+  if (tensor_plan_reserve((void**)&plan->values,
+                          plan->num_values,
+                          &plan->value_capacity,
+                          sizeof(TensorPlanValue)) != 0) {
+    return TENSOR_PLAN_INVALID;
+  }
+  TensorPlanValue* value = &plan->values[plan->num_values];
+  memcpy(value->shape, shape, num_dims * sizeof(size_t));
+  value->num_dims = num_dims;
+  value->num_elements = 1;
+  for (size_t i = 0; i < num_dims; i++) {
+    value->num_elements *= shape[i];
+  }
+  value->kind = kind;
+  value->first = plan->num_steps;
+  value->last = plan->num_steps;
+  value->offset = 0;
+  value->data = NULL;
+  return plan->num_values++;
+}
+
+// Get a captured value, or NULL if the handle is invalid
+static const TensorPlanValue*
+tensor_plan_value(const TensorPlan* plan, size_t value)
+{
+  if (value >= plan->num_values) {
+    fprintf(stderr, "Error: Invalid plan value\n");
+    return NULL;
+  }
+  return &plan->values[value];
+}
+
+// Add a step producing a new intermediate of the given shape
+static size_t
+tensor_plan_add_step(TensorPlan* plan,
+                     TensorPlanStep* step,
+                     const size_t* shape,
+                     size_t num_dims)
+{
+  if (tensor_plan_reserve((void**)&plan->steps,
+                          plan->num_steps,
+                          &plan->step_capacity,
+                          sizeof(TensorPlanStep)) != 0) {
+    return TENSOR_PLAN_INVALID;
+  }
+  step->result = tensor_plan_add_value(
+    plan, shape, num_dims, TENSOR_PLAN_VALUE_INTERMEDIATE);
+  if (step->result == TENSOR_PLAN_INVALID) {
+    return TENSOR_PLAN_INVALID;
+  }
+  plan->steps[plan->num_steps++] = *step;
+  return step->result;
+}
+
+// Capture an input of a fixed shape, bound when the plan runs
+size_t
+tensor_plan_input(TensorPlan* plan, const size_t* shape, size_t num_dims)
+{
+  if (tensor_plan_reserve((void**)&plan->inputs,
+                          plan->num_inputs,
+                          &plan->input_capacity,
+                          sizeof(size_t)) != 0) {
+    return TENSOR_PLAN_INVALID;
+  }
+  size_t value =
+    tensor_plan_add_value(plan, shape, num_dims, TENSOR_PLAN_VALUE_INPUT);
+  if (value != TENSOR_PLAN_INVALID) {
+    plan->inputs[plan->num_inputs++] = value;
+  }
+  return value;
+}
+
+// Capture a matrix multiplication
+size_t
+tensor_plan_matmul(TensorPlan* plan, size_t value1, size_t value2)
+{
+  return tensor_plan_linear(
+    plan, value1, value2, TENSOR_PLAN_INVALID, TENSOR_ACTIVATION_NONE);
+}
+
+// Capture a dense layer, with bias TENSOR_PLAN_INVALID for none
+size_t
+tensor_plan_linear(TensorPlan* plan,
+                   size_t input,
+                   size_t weight,
+                   size_t bias,
+                   TensorActivation activation)
+{
+  const TensorPlanValue* a = tensor_plan_value(plan, input);
+  const TensorPlanValue* b = tensor_plan_value(plan, weight);
+  if (a == NULL || b == NULL) {
+    return TENSOR_PLAN_INVALID;
+  }
+
+  // Check if values are compatible for matrix multiplication
+  if (a->num_dims != 2 || b->num_dims != 2 || a->shape[1] != b->shape[0]) {
+    fprintf(stderr,
+            "Error: Tensors are not compatible for matrix multiplication\n");
+    return TENSOR_PLAN_INVALID;
+  }
+  TensorPlanStep step = { TENSOR_PLAN_STEP_GEMM,
+                          { input, weight },
+                          2,
+                          0,
+                          0,
+                          activation,
+                          0,
+                          { a->shape[0], b->shape[1], a->shape[1] } };
+  if (bias != TENSOR_PLAN_INVALID) {
+    const TensorPlanValue* c = tensor_plan_value(plan, bias);
+    if (c == NULL) {
+      return TENSOR_PLAN_INVALID;
+    }
+    if (c->num_dims != 1 || c->shape[0] != b->shape[1]) {
+      fprintf(stderr, "Error: Bias is not compatible for dense layer\n");
+      return TENSOR_PLAN_INVALID;
+    }
+    step.operands[step.num_operands++] = bias;
+  }
+  size_t shape[2] = { a->shape[0], b->shape[1] };
+  return tensor_plan_add_step(plan, &step, shape, 2);
+}
+
+// Capture an element-wise operation between two values
+size_t
+tensor_plan_binary(TensorPlan* plan,
+                   TensorPlanBinary op,
+                   size_t value1,
+                   size_t value2)
+{
+  const TensorPlanValue* a = tensor_plan_value(plan, value1);
+  const TensorPlanValue* b = tensor_plan_value(plan, value2);
+  if (a == NULL || b == NULL) {
+    return TENSOR_PLAN_INVALID;
+  }
+
+  // Check if values are compatible for an element-wise operation
+  if (a->num_dims != b->num_dims ||
+      memcmp(a->shape, b->shape, a->num_dims * sizeof(size_t)) != 0) {
+    fprintf(stderr,
+            "Error: Tensors are not compatible for element-wise operation\n");
+    return TENSOR_PLAN_INVALID;
+  }
+  TensorPlanStep step = {
+    TENSOR_PLAN_STEP_BINARY, { value1, value2 }, 2, 0, (int)op
+  };
+  size_t shape[TENSOR_MAX_DIMS];
+  memcpy(shape, a->shape, a->num_dims * sizeof(size_t));
+  return tensor_plan_add_step(plan, &step, shape, a->num_dims);
+}
+
+// Capture an element-wise activation
+size_t
+tensor_plan_activation(TensorPlan* plan,
+                       size_t value,
+                       TensorActivation activation)
+{
+  const TensorPlanValue* a = tensor_plan_value(plan, value);
+  if (a == NULL) {
+    return TENSOR_PLAN_INVALID;
+  }
+  TensorPlanStep step = {
+    TENSOR_PLAN_STEP_ACTIVATION, { value }, 1, 0, 0, activation
+  };
+  size_t shape[TENSOR_MAX_DIMS];
+  memcpy(shape, a->shape, a->num_dims * sizeof(size_t));
+  return tensor_plan_add_step(plan, &step, shape, a->num_dims);
+}
+
+// Capture a multiplication by a scalar
+size_t
+tensor_plan_scalar_multiply(TensorPlan* plan, size_t value, tensor_dtype scalar)
+{
+  const TensorPlanValue* a = tensor_plan_value(plan, value);
+  if (a == NULL) {
+    return TENSOR_PLAN_INVALID;
+  }
+  TensorPlanStep step = {
+    TENSOR_PLAN_STEP_SCALE, { value }, 1, 0, 0, TENSOR_ACTIVATION_NONE, scalar
+  };
+  size_t shape[TENSOR_MAX_DIMS];
+  memcpy(shape, a->shape, a->num_dims * sizeof(size_t));
+  return tensor_plan_add_step(plan, &step, shape, a->num_dims);
+}
+
+// Capture a reduction along an axis
+size_t
+tensor_plan_reduce(TensorPlan* plan,
+                   TensorPlanReduce op,
+                   size_t value,
+                   size_t axis)
+{
+  const TensorPlanValue* a = tensor_plan_value(plan, value);
+  if (a == NULL) {
+    return TENSOR_PLAN_INVALID;
+  }
+
+  // Check if axis is valid
+  if (axis >= a->num_dims) {
+    fprintf(stderr, "Error: Axis is out of bounds\n");
+    return TENSOR_PLAN_INVALID;
+  }
+  if (a->shape[axis] == 0 && op != TENSOR_PLAN_SUM) {
+    fprintf(stderr, "Error: Axis is empty\n");
+    return TENSOR_PLAN_INVALID;
+  }
+
+  // View the value as inner by length by outer elements around the axis
+  size_t inner = 1;
+  size_t outer = 1;
+  size_t shape[TENSOR_MAX_DIMS];
+  for (size_t i = 0, j = 0; i < a->num_dims; i++) {
+    if (i < axis) {
+      inner *= a->shape[i];
+    } else if (i > axis) {
+      outer *= a->shape[i];
+    }
+    if (i != axis) {
+      shape[j++] = a->shape[i];
+    }
+  }
+  TensorPlanStep step = { TENSOR_PLAN_STEP_REDUCE,
+                          { value },
+                          1,
+                          0,
+                          (int)op,
+                          TENSOR_ACTIVATION_NONE,
+                          0,
+                          { inner, a->shape[axis], outer } };
+  return tensor_plan_add_step(plan, &step, shape, a->num_dims - 1);
+}
+
+// Mark a value as an output of the plan
+int
+tensor_plan_output(TensorPlan* plan, size_t value)
+{
+  if (tensor_plan_value(plan, value) == NULL) {
+    return -1;
+  }
+  if (plan->compiled) {
+    fprintf(stderr, "Error: Plan is already compiled\n");
+    return -1;
+  }
+  if (plan->values[value].kind != TENSOR_PLAN_VALUE_INTERMEDIATE) {
+    fprintf(stderr, "Error: Plan output must be computed by the plan\n");
+    return -1;
+  }
+  if (tensor_plan_reserve((void**)&plan->outputs,
+                          plan->num_outputs,
+                          &plan->output_capacity,
+                          sizeof(size_t)) != 0) {
+    return -1;
+  }
+  plan->values[value].kind = TENSOR_PLAN_VALUE_OUTPUT;
+  plan->outputs[plan->num_outputs++] = value;
+  return 0;
+}
+
+/**
+ * Assigns arena offsets to the intermediates of a plan.
+ *
+ * An intermediate lives from the step computing it to the last step reading
+ * it, so the operands of a step are always live while it writes its result
+ * and never share memory with it. Intermediates are placed largest first,
+ * each into the smallest gap between the intermediates already placed whose
+ * lifetimes overlap its own, or past the last of them if no gap fits.
+ *
+ * @param plan The plan with lifetimes computed.
+ * @return The number of elements of the arena, or TENSOR_PLAN_INVALID if
+ * memory allocation fails.
+ */
+static size_t
+tensor_plan_assign_offsets(TensorPlan* plan)
+{
+  size_t* order =
+    (size_t*)malloc((2 * plan->num_values + 1) * sizeof(size_t));
+  if (order == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for plan\n");
+    return TENSOR_PLAN_INVALID;
+  }
+  size_t* placed = order + plan->num_values;
+  size_t num_order = 0;
+  for (size_t v = 0; v < plan->num_values; v++) {
+    if (plan->values[v].kind == TENSOR_PLAN_VALUE_INTERMEDIATE) {
+      order[num_order++] = v;
+    }
+  }
+
+  // Sort intermediates by decreasing size, stable on the step computing them
+  for (size_t i = 1; i < num_order; i++) {
+    size_t v = order[i];
+    size_t j = i;
+    while (j > 0 &&
+           plan->values[order[j - 1]].num_elements <
+             plan->values[v].num_elements) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = v;
+  }
+
+  size_t arena_elements = 0;
+  for (size_t i = 0; i < num_order; i++) {
+    TensorPlanValue* value = &plan->values[order[i]];
+    size_t size = (value->num_elements + TENSOR_PLAN_ALIGN - 1) /
+                  TENSOR_PLAN_ALIGN * TENSOR_PLAN_ALIGN;
+
+    // Collect placed intermediates live at the same time, by offset
+    size_t num_placed = 0;
+    for (size_t j = 0; j < i; j++) {
+      const TensorPlanValue* other = &plan->values[order[j]];
+      if (other->first <= value->last && value->first <= other->last) {
+        size_t k = num_placed++;
+        while (k > 0 && plan->values[placed[k - 1]].offset > other->offset) {
+          placed[k] = placed[k - 1];
+          k--;
+        }
+        placed[k] = order[j];
+      }
+    }
+
+    // Take the smallest gap that fits, or the end of the live intermediates
+    size_t best = TENSOR_PLAN_INVALID;
+    size_t best_gap = TENSOR_PLAN_INVALID;
+    size_t cursor = 0;
+    for (size_t j = 0; j < num_placed; j++) {
+      const TensorPlanValue* other = &plan->values[placed[j]];
+      if (other->offset >= cursor + size &&
+          other->offset - cursor < best_gap) {
+        best = cursor;
+        best_gap = other->offset - cursor;
+      }
+      size_t end = other->offset + (other->num_elements + TENSOR_PLAN_ALIGN -
+                                    1) / TENSOR_PLAN_ALIGN * TENSOR_PLAN_ALIGN;
+      cursor = end > cursor ? end : cursor;
+    }
+    value->offset = best != TENSOR_PLAN_INVALID ? best : cursor;
+    if (value->offset + size > arena_elements) {
+      arena_elements = value->offset + size;
+    }
+  }
+  free(order);
+  return arena_elements;
+}
+
+/**
+ * Plans the memory of the captured operations and allocates it.
+ *
+ * Every intermediate gets an offset in one arena, shared with intermediates
+ * whose lifetimes do not overlap, and every output gets a tensor of its own
+ * that later runs overwrite. After compiling, the plan cannot capture more
+ * operations.
+ *
+ * @param plan The plan to compile.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_plan_compile(TensorPlan* plan)
+{
+  if (plan->compiled) {
+    fprintf(stderr, "Error: Plan is already compiled\n");
+    return -1;
+  }
+
+  // Extend each value's lifetime to the last step reading it
+  for (size_t s = 0; s < plan->num_steps; s++) {
+    const TensorPlanStep* step = &plan->steps[s];
+    for (size_t i = 0; i < step->num_operands; i++) {
+      plan->values[step->operands[i]].last = s;
+    }
+  }
+
+  // Create the output tensors, releasing any left by a failed attempt
+  tensor_plan_free_results(plan);
+  plan->results = (Tensor**)calloc(plan->num_outputs + 1, sizeof(Tensor*));
+  if (plan->results == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for plan\n");
+    return -1;
+  }
+  for (size_t i = 0; i < plan->num_outputs; i++) {
+    TensorPlanValue* value = &plan->values[plan->outputs[i]];
+    plan->results[i] = tensor_create(value->shape, value->num_dims);
+    if (plan->results[i] == NULL) {
+      tensor_plan_free_results(plan);
+      return -1;
+    }
+    value->data = plan->results[i]->data;
+  }
+
+  // Place the intermediates in one arena
+  size_t arena_elements = tensor_plan_assign_offsets(plan);
+  if (arena_elements == TENSOR_PLAN_INVALID) {
+    tensor_plan_free_results(plan);
+    return -1;
+  }
+  if (arena_elements > 0) {
+    plan->arena = (tensor_dtype*)aligned_alloc(
+      64, arena_elements * sizeof(tensor_dtype));
+    if (plan->arena == NULL) {
+      fprintf(stderr, "Error: Unable to allocate memory for plan arena\n");
+      tensor_plan_free_results(plan);
+      return -1;
+    }
+  }
+  plan->arena_elements = arena_elements;
+  for (size_t v = 0; v < plan->num_values; v++) {
+    if (plan->values[v].kind == TENSOR_PLAN_VALUE_INTERMEDIATE) {
+      plan->values[v].data = plan->arena + plan->values[v].offset;
+    }
+  }
+  plan->compiled = 1;
+  return 0;
+}
+
+// Get the size of the arena holding the intermediates, in bytes
+size_t
+tensor_plan_arena_size(const TensorPlan* plan)
+{
+  return plan->arena_elements * sizeof(tensor_dtype);
+}
+
+// Reduce a value viewed as inner by length by outer elements along the middle
+static void
+tensor_plan_reduce_kernel(const TensorPlanStep* step,
+                          const tensor_dtype* src,
+                          tensor_dtype* dst)
+{
+  size_t inner = step->dims[0];
+  size_t length = step->dims[1];
+  size_t outer = step->dims[2];
+  for (size_t o = 0; o < outer; o++) {
+    const tensor_dtype* slab = src + o * inner * length;
+    tensor_dtype* out = dst + o * inner;
+    if (length == 0) {
+      memset(out, 0, inner * sizeof(tensor_dtype));
+      continue;
+    }
+    memcpy(out, slab, inner * sizeof(tensor_dtype));
+    for (size_t t = 1; t < length; t++) {
+      const tensor_dtype* row = slab + t * inner;
+      switch ((TensorPlanReduce)step->op) {
+        case TENSOR_PLAN_SUM:
+        case TENSOR_PLAN_MEAN:
+          for (size_t i = 0; i < inner; i++) {
+            out[i] += row[i];
+          }
+          break;
+        case TENSOR_PLAN_MAX:
+          for (size_t i = 0; i < inner; i++) {
+            out[i] = fmax(out[i], row[i]);
+          }
+          break;
+        case TENSOR_PLAN_MIN:
+          for (size_t i = 0; i < inner; i++) {
+            out[i] = fmin(out[i], row[i]);
+          }
+          break;
+      }
+    }
+    if (step->op == TENSOR_PLAN_MEAN) {
+      for (size_t i = 0; i < inner; i++) {
+        out[i] /= (tensor_dtype)length;
+      }
+    }
+  }
+}
+
+/**
+ * Runs a compiled plan.
+ *
+ * The inputs are bound in the order they were captured and must have the
+ * captured shapes, which are not checked again. Each run overwrites the
+ * outputs of the previous one in place and allocates nothing. If the caller
+ * still holds a clone of a previous output, that output alone is moved to
+ * fresh storage, without copying data the run is about to overwrite, so the
+ * clone keeps its values. A plan runs one call at a time.
+ *
+ * @param plan The compiled plan.
+ * @param inputs The input tensors.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int
+tensor_plan_run(TensorPlan* plan, const Tensor* const* inputs)
+{
+  if (!plan->compiled) {
+    fprintf(stderr, "Error: Plan is not compiled\n");
+    return -1;
+  }
+
+  // Bind the inputs and keep earlier results held by the caller intact
+  for (size_t i = 0; i < plan->num_inputs; i++) {
+    plan->values[plan->inputs[i]].data = inputs[i]->data;
+  }
+  for (size_t i = 0; i < plan->num_outputs; i++) {
+    if (tensor_detach(plan->results[i], 0) != 0) {
+      return -1;
+    }
+    plan->values[plan->outputs[i]].data = plan->results[i]->data;
+  }
+
+  // Run the steps
+  for (size_t s = 0; s < plan->num_steps; s++) {
+    const TensorPlanStep* step = &plan->steps[s];
+    const TensorPlanValue* values = plan->values;
+    const tensor_dtype* a = values[step->operands[0]].data;
+    const tensor_dtype* b =
+      step->num_operands > 1 ? values[step->operands[1]].data : NULL;
+    tensor_dtype* out = values[step->result].data;
+    size_t count = values[step->result].num_elements;
+    switch (step->kind) {
+      case TENSOR_PLAN_STEP_GEMM:
+        tensor_gemm(step->dims[0],
+                    step->dims[1],
+                    step->dims[2],
+                    a,
+                    b,
+                    out,
+                    step->num_operands > 2 ? values[step->operands[2]].data
+                                           : NULL,
+                    step->activation);
+        break;
+      case TENSOR_PLAN_STEP_BINARY:
+        switch ((TensorPlanBinary)step->op) {
+          case TENSOR_PLAN_ADD:
+            for (size_t i = 0; i < count; i++) {
+              out[i] = a[i] + b[i];
+            }
+            break;
+          case TENSOR_PLAN_SUBTRACT:
+            for (size_t i = 0; i < count; i++) {
+              out[i] = a[i] - b[i];
+            }
+            break;
+          case TENSOR_PLAN_MULTIPLY:
+            for (size_t i = 0; i < count; i++) {
+              out[i] = a[i] * b[i];
+            }
+            break;
+          case TENSOR_PLAN_DIVIDE:
+            for (size_t i = 0; i < count; i++) {
+              out[i] = a[i] / b[i];
+            }
+            break;
+        }
+        break;
+      case TENSOR_PLAN_STEP_ACTIVATION:
+        memcpy(out, a, count * sizeof(tensor_dtype));
+        tensor_activate(out, count, step->activation);
+        break;
+      case TENSOR_PLAN_STEP_SCALE:
+        for (size_t i = 0; i < count; i++) {
+          out[i] = a[i] * step->scalar;
+        }
+        break;
+      case TENSOR_PLAN_STEP_REDUCE:
+        tensor_plan_reduce_kernel(step, a, out);
+        break;
+    }
+  }
+  return 0;
+}
+
+// Get an output of the last run, in the order the outputs were marked
+const Tensor*
+tensor_plan_result(const TensorPlan* plan, size_t index)
+{
+  if (!plan->compiled || index >= plan->num_outputs) {
+    fprintf(stderr, "Error: Plan output is out of bounds\n");
+    return NULL;
+  }
+  return plan->results[index];
+}
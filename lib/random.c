@@ -0,0 +1,211 @@
+// Includes
+#include "../includes/random.h"
+#include "../includes/thread_pool.h"
+#include <math.h>
+#include <stdio.h>
+
+// Philox4x32 round multipliers and key schedule constants
+#define TENSOR_PHILOX_M0 0xD2511F53u
+#define TENSOR_PHILOX_M1 0xCD9E8D57u
+#define TENSOR_PHILOX_W0 0x9E3779B9u
+#define TENSOR_PHILOX_W1 0xBB67AE85u
+
+// Number of Philox blocks generated per parallel chunk
+#define TENSOR_RANDOM_GRAIN 4096
+
+// Distribution sampled by a parallel fill
+typedef enum
+{
+  TENSOR_RANDOM_UNIFORM,
+  TENSOR_RANDOM_NORMAL,
+  TENSOR_RANDOM_BERNOULLI
+} TensorDistribution;
+
+// Arguments of a parallel random fill
+typedef struct
+{
+  tensor_dtype* data;
+  size_t num_elements;
+  uint32_t key[2];
+  uint64_t offset;
+  TensorDistribution distribution;
+  tensor_dtype a;
+  tensor_dtype b;
+} TensorRandomFill;
+
+/**
+ * Computes one Philox4x32-10 block from a counter and a key.
+ *
+ * Philox is a counter-based generator: the output is a pure function of the
+ * counter and the key, so any element of a random stream can be computed
+ * independently of every other element.
+ *
+ * @param counter The 128-bit counter.
+ * @param key The 64-bit key.
+ * @param output Receives four 32-bit random words.
+ */
+void
+tensor_philox(const uint32_t counter[4],
+              const uint32_t key[2],
+              uint32_t output[4])
+{
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < 10; round++) {
+    uint64_t product0 = (uint64_t)TENSOR_PHILOX_M0 * c0;
+    uint64_t product1 = (uint64_t)TENSOR_PHILOX_M1 * c2;
+    uint32_t hi0 = (uint32_t)(product0 >> 32), lo0 = (uint32_t)product0;
+    uint32_t hi1 = (uint32_t)(product1 >> 32), lo1 = (uint32_t)product1;
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += TENSOR_PHILOX_W0;
+    k1 += TENSOR_PHILOX_W1;
+  }
+  output[0] = c0;
+  output[1] = c1;
+  output[2] = c2;
+  output[3] = c3;
+}
+
+// Initialize a generator from a seed
+void
+tensor_generator_init(TensorGenerator* generator, uint64_t seed)
+{
+  generator->seed = seed;
+  generator->offset = 0;
+}
+
+// Convert two random words to a double in [0, 1) with 53 random bits
+static tensor_dtype
+tensor_random_unit(uint32_t hi, uint32_t lo)
+{
+  uint64_t bits = ((uint64_t)hi << 32 | lo) >> 11;
+  return (tensor_dtype)bits * 0x1.0p-53;
+}
+
+// Fill a range of Philox blocks, each producing two elements
+static void
+tensor_random_range(void* arg, size_t begin, size_t end)
+{
+  TensorRandomFill* fill = (TensorRandomFill*)arg;
+  for (size_t block = begin; block < end; block++) {
+    uint32_t counter[4] = { (uint32_t)block,
+                            (uint32_t)((uint64_t)block >> 32),
+                            (uint32_t)fill->offset,
+                            (uint32_t)(fill->offset >> 32) };
+    uint32_t words[4];
+    tensor_philox(counter, fill->key, words);
+    tensor_dtype u0 = tensor_random_unit(words[0], words[1]);
+    tensor_dtype u1 = tensor_random_unit(words[2], words[3]);
+
+    tensor_dtype values[2] = { 0, 0 };
+    switch (fill->distribution) {
+      case TENSOR_RANDOM_UNIFORM:
+        values[0] = fill->a + (fill->b - fill->a) * u0;
+        values[1] = fill->a + (fill->b - fill->a) * u1;
+        break;
+      case TENSOR_RANDOM_NORMAL: {
+        // Box-Muller transform, with 1 - u0 in (0, 1] to keep the log finite
+        tensor_dtype radius = sqrt(-2.0 * log(1.0 - u0));
+        tensor_dtype angle = 2.0 * M_PI * u1;
+        values[0] = fill->a + fill->b * radius * cos(angle);
+        values[1] = fill->a + fill->b * radius * sin(angle);
+        break;
+      }
+      case TENSOR_RANDOM_BERNOULLI:
+        values[0] = u0 < fill->a ? 1 : 0;
+        values[1] = u1 < fill->a ? 1 : 0;
+        break;
+    }
+
+    size_t index = 2 * block;
+    fill->data[index] = values[0];
+    if (index + 1 < fill->num_elements) {
+      fill->data[index + 1] = values[1];
+    }
+  }
+}
+
+/**
+ * Creates a new tensor of samples from a distribution.
+ *
+ * Element i is derived from Philox block i / 2 under the generator's seed and
+ * current offset, so the output is bit-identical for any number of threads.
+ * Each call consumes one offset, giving the next call an independent stream.
+ *
+ * @param generator The generator to draw from.
+ * @param shape The shape of the tensor.
+ * @param num_dims The number of dimensions of the tensor.
+ * @param distribution The distribution to sample.
+ * @param a The first distribution parameter.
+ * @param b The second distribution parameter.
+ * @return A pointer to the new tensor, or NULL if memory allocation fails.
+ */
+static Tensor*
+tensor_random(TensorGenerator* generator,
+              const size_t* shape,
+              size_t num_dims,
+              TensorDistribution distribution,
+              tensor_dtype a,
+              tensor_dtype b)
+{
+  Tensor* tensor = tensor_create(shape, num_dims);
+  if (tensor == NULL) {
+    return NULL;
+  }
+  TensorRandomFill fill = { tensor->data,
+                            tensor->num_elements,
+                            { (uint32_t)generator->seed,
+                              (uint32_t)(generator->seed >> 32) },
+                            generator->offset++,
+                            distribution,
+                            a,
+                            b };
+  thread_pool_parallel_for((tensor->num_elements + 1) / 2,
+                           TENSOR_RANDOM_GRAIN,
+                           tensor_random_range,
+                           &fill);
+  return tensor;
+}
+
+// Create a new tensor of uniform samples in [low, high)
+Tensor*
+tensor_random_uniform(TensorGenerator* generator,
+                      const size_t* shape,
+                      size_t num_dims,
+                      tensor_dtype low,
+                      tensor_dtype high)
+{
+  return tensor_random(
+    generator, shape, num_dims, TENSOR_RANDOM_UNIFORM, low, high);
+}
+
+// Create a new tensor of normal samples with the given mean and deviation
+Tensor*
+tensor_random_normal(TensorGenerator* generator,
+                     const size_t* shape,
+                     size_t num_dims,
+                     tensor_dtype mean,
+                     tensor_dtype std)
+{
+  return tensor_random(
+    generator, shape, num_dims, TENSOR_RANDOM_NORMAL, mean, std);
+}
+
+// Create a new tensor of Bernoulli samples that are 1 with probability p
+Tensor*
+tensor_random_bernoulli(TensorGenerator* generator,
+                        const size_t* shape,
+                        size_t num_dims,
+                        tensor_dtype p)
+{
+  // Check if probability is valid
+  if (!(p >= 0 && p <= 1)) {
+    fprintf(stderr, "Error: Probability is out of bounds\n");
+    return NULL;
+  }
+  return tensor_random(
+    generator, shape, num_dims, TENSOR_RANDOM_BERNOULLI, p, 0);
+}
@@ -0,0 +1,433 @@
+// Includes
+#include "../includes/stream.h"
+#include "../includes/thread_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Kind of operation held by a stream task
+typedef enum
+{
+  TENSOR_STREAM_GENERIC,
+  TENSOR_STREAM_UNARY,
+  TENSOR_STREAM_BINARY,
+  TENSOR_STREAM_AXIS,
+  TENSOR_STREAM_SCALAR
+} TensorStreamKind;
+
+// Link of a task into the waiter list of a future it depends on
+typedef struct TensorStreamWait
+{
+  struct TensorStreamTask* task;
+  struct TensorStreamWait* next;
+} TensorStreamWait;
+
+// Operation waiting on its inputs and on the previous operation of its stream
+typedef struct TensorStreamTask
+{
+  TensorStreamKind kind;
+  union
+  {
+    TensorStreamOp generic;
+    TensorUnaryOp unary;
+    TensorBinaryOp binary;
+    TensorAxisOp axis;
+    TensorScalarOp scalar;
+  } op;
+  void* arg;
+  size_t axis;
+  tensor_dtype scalar;
+  TensorFuture* inputs[TENSOR_STREAM_MAX_INPUTS];
+  size_t num_inputs;
+  TensorFuture* previous;
+  TensorFuture* output;
+  size_t pending;
+  TensorStreamWait waits[TENSOR_STREAM_MAX_INPUTS + 1];
+} TensorStreamTask;
+
+// Future definition
+struct TensorFuture
+{
+  Tensor* result;
+  int done;
+  size_t refs;
+  TensorStreamWait* waiters;
+};
+
+// Stream definition
+struct TensorStream
+{
+  TensorFuture* tail;
+};
+
+// Scheduler state shared by all streams and futures
+static pthread_mutex_t tensor_stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tensor_stream_cond = PTHREAD_COND_INITIALIZER;
+
+// Allocate an empty future
+static TensorFuture*
+tensor_future_create(void)
+{
+  TensorFuture* future = (TensorFuture*)calloc(1, sizeof(TensorFuture));
+  if (future == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for tensor future\n");
+  }
+  return future;
+}
+
+// Drop a reference to a future, with the scheduler lock held
+static void
+tensor_future_release_locked(TensorFuture* future)
+{
+  if (--future->refs > 0) {
+    return;
+  }
+  if (future->result != NULL) {
+    tensor_free(future->result);
+  }
+  free(future);
+}
+
+// Run a task on a pool worker and complete its future
+static void
+tensor_stream_run(void* arg)
+{
+  TensorStreamTask* task = (TensorStreamTask*)arg;
+
+  // Inputs are complete and immutable, so they are read without the lock
+  const Tensor* inputs[TENSOR_STREAM_MAX_INPUTS];
+  int failed = 0;
+  for (size_t i = 0; i < task->num_inputs; i++) {
+    inputs[i] = task->inputs[i]->result;
+    failed |= inputs[i] == NULL;
+  }
+  Tensor* result = NULL;
+  if (!failed) {
+    switch (task->kind) {
+      case TENSOR_STREAM_GENERIC:
+        result = task->op.generic(inputs, task->arg);
+        break;
+      case TENSOR_STREAM_UNARY:
+        result = task->op.unary(inputs[0]);
+        break;
+      case TENSOR_STREAM_BINARY:
+        result = task->op.binary(inputs[0], inputs[1]);
+        break;
+      case TENSOR_STREAM_AXIS:
+        result = task->op.axis(inputs[0], task->axis);
+        break;
+      case TENSOR_STREAM_SCALAR:
+        result = task->op.scalar(inputs[0], task->scalar);
+        break;
+    }
+  }
+
+  // Publish the result and release the tasks waiting on it, keeping those
+  // the pool cannot take to run inline once the lock is dropped
+  pthread_mutex_lock(&tensor_stream_mutex);
+  TensorFuture* output = task->output;
+  output->result = result;
+  output->done = 1;
+  TensorStreamWait* unsubmitted = NULL;
+  TensorStreamWait* next;
+  for (TensorStreamWait* wait = output->waiters; wait != NULL; wait = next) {
+    next = wait->next;
+    if (--wait->task->pending == 0 &&
+        thread_pool_submit(tensor_stream_run, wait->task) != 0) {
+      wait->next = unsubmitted;
+      unsubmitted = wait;
+    }
+  }
+  output->waiters = NULL;
+  pthread_cond_broadcast(&tensor_stream_cond);
+  for (size_t i = 0; i < task->num_inputs; i++) {
+    tensor_future_release_locked(task->inputs[i]);
+  }
+  if (task->previous != NULL) {
+    tensor_future_release_locked(task->previous);
+  }
+  tensor_future_release_locked(output);
+  pthread_mutex_unlock(&tensor_stream_mutex);
+  free(task);
+
+  // Fall back to running inline the tasks the pool could not take
+  for (TensorStreamWait* wait = unsubmitted; wait != NULL; wait = next) {
+    next = wait->next;
+    tensor_stream_run(wait->task);
+  }
+}
+
+// Make a task wait on a future, with the scheduler lock held
+static void
+tensor_stream_depend(TensorStreamTask* task, TensorFuture* future, size_t slot)
+{
+  future->refs++;
+  if (future->done) {
+    return;
+  }
+  TensorStreamWait* wait = &task->waits[slot];
+  wait->task = task;
+  wait->next = future->waiters;
+  future->waiters = wait;
+  task->pending++;
+}
+
+/**
+ * Enqueues a prepared task on a stream.
+ *
+ * The task runs once all of its input futures and the previous operation on
+ * the same stream have completed. Operations on different streams only wait
+ * for each other through the futures they share, so independent streams run
+ * concurrently on the thread pool.
+ *
+ * @param stream The stream to enqueue on.
+ * @param task The task with its operation and inputs set; ownership is taken.
+ * @return A future for the result, or NULL on error.
+ */
+static TensorFuture*
+tensor_stream_push(TensorStream* stream, TensorStreamTask* task)
+{
+  TensorFuture* output = tensor_future_create();
+  if (output == NULL) {
+    free(task);
+    return NULL;
+  }
+
+  // The caller, the stream tail and the task each hold a reference
+  output->refs = 3;
+  task->output = output;
+  task->pending = 0;
+
+  pthread_mutex_lock(&tensor_stream_mutex);
+  for (size_t i = 0; i < task->num_inputs; i++) {
+    tensor_stream_depend(task, task->inputs[i], i);
+  }
+  task->previous = stream->tail;
+  if (task->previous != NULL) {
+    tensor_stream_depend(task, task->previous, task->num_inputs);
+  }
+  if (stream->tail != NULL) {
+    tensor_future_release_locked(stream->tail);
+  }
+  stream->tail = output;
+  int ready = task->pending == 0;
+  pthread_mutex_unlock(&tensor_stream_mutex);
+
+  // Fall back to running inline if the pool cannot take the task
+  if (ready && thread_pool_submit(tensor_stream_run, task) != 0) {
+    tensor_stream_run(task);
+  }
+  return output;
+}
+
+// Allocate a task with its inputs set
+static TensorStreamTask*
+tensor_stream_task_create(TensorStreamKind kind,
+                          TensorFuture* const* inputs,
+                          size_t num_inputs)
+{
+  if (num_inputs > TENSOR_STREAM_MAX_INPUTS) {
+    fprintf(stderr, "Error: Too many inputs for tensor stream operation\n");
+    return NULL;
+  }
+  for (size_t i = 0; i < num_inputs; i++) {
+    if (inputs[i] == NULL) {
+      fprintf(stderr, "Error: Tensor stream input is NULL\n");
+      return NULL;
+    }
+  }
+  TensorStreamTask* task =
+    (TensorStreamTask*)calloc(1, sizeof(TensorStreamTask));
+  if (task == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for stream task\n");
+    return NULL;
+  }
+  task->kind = kind;
+  for (size_t i = 0; i < num_inputs; i++) {
+    task->inputs[i] = inputs[i];
+  }
+  task->num_inputs = num_inputs;
+  return task;
+}
+
+// Create a new stream
+TensorStream*
+tensor_stream_create(void)
+{
+  TensorStream* stream = (TensorStream*)malloc(sizeof(TensorStream));
+  if (stream == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for tensor stream\n");
+    return NULL;
+  }
+  stream->tail = NULL;
+  return stream;
+}
+
+// Wait for all work on a stream, then free it
+void
+tensor_stream_free(TensorStream* stream)
+{
+  tensor_stream_synchronize(stream);
+  if (stream->tail != NULL) {
+    tensor_future_release(stream->tail);
+  }
+  free(stream);
+}
+
+// Wait for all work enqueued on a stream so far
+void
+tensor_stream_synchronize(TensorStream* stream)
+{
+  // Operations complete in order, so waiting on the tail waits on all
+  pthread_mutex_lock(&tensor_stream_mutex);
+  TensorFuture* tail = stream->tail;
+  if (tail != NULL) {
+    tail->refs++;
+    while (!tail->done) {
+      pthread_cond_wait(&tensor_stream_cond, &tensor_stream_mutex);
+    }
+    tensor_future_release_locked(tail);
+  }
+  pthread_mutex_unlock(&tensor_stream_mutex);
+}
+
+// Enqueue a generic operation on a stream
+TensorFuture*
+tensor_stream_enqueue(TensorStream* stream,
+                      TensorStreamOp op,
+                      TensorFuture* const* inputs,
+                      size_t num_inputs,
+                      void* arg)
+{
+  TensorStreamTask* task =
+    tensor_stream_task_create(TENSOR_STREAM_GENERIC, inputs, num_inputs);
+  if (task == NULL) {
+    return NULL;
+  }
+  task->op.generic = op;
+  task->arg = arg;
+  return tensor_stream_push(stream, task);
+}
+
+// Enqueue a unary operation on a stream
+TensorFuture*
+tensor_stream_unary(TensorStream* stream, TensorUnaryOp op, TensorFuture* input)
+{
+  TensorStreamTask* task =
+    tensor_stream_task_create(TENSOR_STREAM_UNARY, &input, 1);
+  if (task == NULL) {
+    return NULL;
+  }
+  task->op.unary = op;
+  return tensor_stream_push(stream, task);
+}
+
+// Enqueue a binary operation on a stream
+TensorFuture*
+tensor_stream_binary(TensorStream* stream,
+                     TensorBinaryOp op,
+                     TensorFuture* input1,
+                     TensorFuture* input2)
+{
+  TensorFuture* inputs[2] = { input1, input2 };
+  TensorStreamTask* task =
+    tensor_stream_task_create(TENSOR_STREAM_BINARY, inputs, 2);
+  if (task == NULL) {
+    return NULL;
+  }
+  task->op.binary = op;
+  return tensor_stream_push(stream, task);
+}
+
+// Enqueue an operation along an axis on a stream
+TensorFuture*
+tensor_stream_axis(TensorStream* stream,
+                   TensorAxisOp op,
+                   TensorFuture* input,
+                   size_t axis)
+{
+  TensorStreamTask* task =
+    tensor_stream_task_create(TENSOR_STREAM_AXIS, &input, 1);
+  if (task == NULL) {
+    return NULL;
+  }
+  task->op.axis = op;
+  task->axis = axis;
+  return tensor_stream_push(stream, task);
+}
+
+// Enqueue an operation with a scalar on a stream
+TensorFuture*
+tensor_stream_scalar(TensorStream* stream,
+                     TensorScalarOp op,
+                     TensorFuture* input,
+                     tensor_dtype scalar)
+{
+  TensorStreamTask* task =
+    tensor_stream_task_create(TENSOR_STREAM_SCALAR, &input, 1);
+  if (task == NULL) {
+    return NULL;
+  }
+  task->op.scalar = op;
+  task->scalar = scalar;
+  return tensor_stream_push(stream, task);
+}
+
+/**
+ * Creates a completed future holding a shared copy of an existing tensor.
+ *
+ * This is how host tensors enter a stream. The copy shares the tensor's
+ * storage, so it costs no data copy, and the caller may modify or free the
+ * tensor as soon as this returns.
+ *
+ * @param tensor The tensor to wrap.
+ * @return A completed future, or NULL if memory allocation fails.
+ */
+TensorFuture*
+tensor_future_from_tensor(const Tensor* tensor)
+{
+  Tensor* clone = tensor_clone(tensor);
+  if (clone == NULL) {
+    return NULL;
+  }
+  TensorFuture* future = tensor_future_create();
+  if (future == NULL) {
+    tensor_free(clone);
+    return NULL;
+  }
+  future->result = clone;
+  future->done = 1;
+  future->refs = 1;
+  return future;
+}
+
+// Check if a future has completed without blocking
+int
+tensor_future_ready(TensorFuture* future)
+{
+  pthread_mutex_lock(&tensor_stream_mutex);
+  int done = future->done;
+  pthread_mutex_unlock(&tensor_stream_mutex);
+  return done;
+}
+
+// Wait for a future and return its result, or NULL if the operation failed
+const Tensor*
+tensor_future_wait(TensorFuture* future)
+{
+  pthread_mutex_lock(&tensor_stream_mutex);
+  while (!future->done) {
+    pthread_cond_wait(&tensor_stream_cond, &tensor_stream_mutex);
+  }
+  pthread_mutex_unlock(&tensor_stream_mutex);
+  return future->result;
+}
+
+// Release a future, freeing its result once no operation still needs it
+void
+tensor_future_release(TensorFuture* future)
+{
+  pthread_mutex_lock(&tensor_stream_mutex);
+  tensor_future_release_locked(future);
+  pthread_mutex_unlock(&tensor_stream_mutex);
+}
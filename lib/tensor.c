@@ -1,32 +1,72 @@
 // Includes
 #include "../includes/tensor.h"
+#include "../includes/autotune.h"
+#include "../includes/kernels.h"
+#include "../includes/thread_pool.h"
 #include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-/**
- * Creates a new tensor with the given shape and number of dimensions.
- *
- * @param shape The shape of the tensor.
- * @param num_dims The number of dimensions of the tensor.
- * @return A pointer to the newly created tensor, or NULL if memory allocation fails.
- */
-Tensor* tensor_create(const size_t* shape, size_t num_dims)
+// Storage definition, with the data allocated inline after the header
+struct TensorStorage
 {
-  // Allocate memory for tensor
-  Tensor* tensor = (Tensor*)malloc(sizeof(Tensor));
+  atomic_size_t refs;
+  size_t num_elements;
+  tensor_dtype data[];
+};
+
+// Allocate storage for the given number of elements with one reference
+static TensorStorage*
+tensor_storage_create(size_t num_elements, int zeroed)
+{
+  // Zeroed storage comes from calloc, which skips the write on fresh pages
+  size_t size = sizeof(TensorStorage) + num_elements * sizeof(tensor_dtype);
+  TensorStorage* storage =
+    (TensorStorage*)(zeroed ? calloc(1, size) : malloc(size));
+  if (storage == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for tensor data\n");
+    return NULL;
+  }
+  atomic_init(&storage->refs, 1);
+  storage->num_elements = num_elements;
+  return storage;
+}
+
+// Drop a reference to storage, freeing it with the last one
+static void
+tensor_storage_release(TensorStorage* storage)
+{
+  if (storage != NULL &&
+      atomic_fetch_sub_explicit(&storage->refs, 1, memory_order_acq_rel) == 1) {
+    free(storage);
+  }
+}
+
+// Allocate a tensor header with its shape and strides inline, but no data
+static Tensor*
+tensor_create_header(const size_t* shape, size_t num_dims)
+{
+  // Check if number of dimensions is supported
+  if (num_dims > TENSOR_MAX_DIMS) {
+    fprintf(stderr, "Error: Tensor has too many dimensions\n");
+    return NULL;
+  }
+
+  // Allocate memory for tensor, with its shape and strides inline
+  Tensor* tensor =
+    (Tensor*)malloc(sizeof(Tensor) + 2 * num_dims * sizeof(size_t));
   if (tensor == NULL) {
     fprintf(stderr, "Error: Unable to allocate memory for tensor\n");
     return NULL;
   }
+  tensor->data = NULL;
+  tensor->storage = NULL;
 
   // Set tensor shape
-  tensor->shape = (size_t*)malloc(num_dims * sizeof(size_t));
-  if (tensor->shape == NULL) {
-    fprintf(stderr, "Error: Unable to allocate memory for tensor shape\n");
-    free(tensor);
-    return NULL;
-  }
+  tensor->shape = (size_t*)(tensor + 1);
+  tensor->strides = tensor->shape + num_dims;
   for (size_t i = 0; i < num_dims; i++) {
     tensor->shape[i] = shape[i];
   }
@@ -34,21 +74,37 @@ Tensor* tensor_create(const size_t* shape, size_t num_dims)
   // Set tensor number of dimensions
   tensor->num_dims = num_dims;
 
-  // Compute tensor number of elements
+  // Compute tensor strides and number of elements
   tensor->num_elements = 1;
   for (size_t i = 0; i < num_dims; i++) {
+    tensor->strides[i] = tensor->num_elements;
     tensor->num_elements *= shape[i];
   }
+  return tensor;
+}
+
+/**
+ * Creates a new tensor with the given shape and number of dimensions.
+ *
+ * @param shape The shape of the tensor.
+ * @param num_dims The number of dimensions of the tensor.
+ * @return A pointer to the newly created tensor, or NULL if memory allocation fails.
+ */
+Tensor* tensor_create(const size_t* shape, size_t num_dims)
+{
+  // Allocate memory for tensor
+  Tensor* tensor = tensor_create_header(shape, num_dims);
+  if (tensor == NULL) {
+    return NULL;
+  }
 
   // Allocate memory for tensor data
-  tensor->data =
-    (tensor_dtype*)malloc(tensor->num_elements * sizeof(tensor_dtype));
-  if (tensor->data == NULL) {
-    fprintf(stderr, "Error: Unable to allocate memory for tensor data\n");
-    free(tensor->shape);
+  tensor->storage = tensor_storage_create(tensor->num_elements, 0);
+  if (tensor->storage == NULL) {
     free(tensor);
     return NULL;
   }
+  tensor->data = tensor->storage->data;
 
   // Return tensor
   return tensor;
@@ -58,24 +114,385 @@ Tensor* tensor_create(const size_t* shape, size_t num_dims)
 void
 tensor_free(Tensor* tensor)
 {
-  free(tensor->data);
-  free(tensor->shape);
+  tensor_storage_release(tensor->storage);
   free(tensor);
 }
 
+/**
+ * Creates a copy of a tensor that shares its data until either is modified.
+ *
+ * Only the header is allocated; the data is shared by reference count and
+ * copied lazily by tensor_make_writable when either tensor is written. A
+ * tensor without reference-counted storage, such as a small tensor, is copied
+ * eagerly instead.
+ *
+ * @param tensor The tensor to clone.
+ * @return A pointer to the clone, or NULL if memory allocation fails.
+ */
+Tensor*
+tensor_clone(const Tensor* tensor)
+{
+  if (tensor->storage == NULL) {
+    Tensor* result = tensor_create(tensor->shape, tensor->num_dims);
+    if (result == NULL) {
+      return NULL;
+    }
+    for (size_t i = 0; i < tensor->num_elements; i++) {
+      result->data[i] = tensor->data[i];
+    }
+    return result;
+  }
+  return tensor_reshape(tensor, tensor->shape, tensor->num_dims);
+}
+
+/**
+ * Creates a view of a tensor's data with a new shape.
+ *
+ * The view shares the tensor's storage, so no data is copied. Writing through
+ * either tensor after tensor_make_writable detaches the writer from the other.
+ *
+ * @param tensor The tensor to view.
+ * @param shape The new shape, with the same number of elements.
+ * @param num_dims The number of dimensions of the new shape.
+ * @return A pointer to the view, or NULL on error.
+ */
+Tensor*
+tensor_reshape(const Tensor* tensor, const size_t* shape, size_t num_dims)
+{
+  Tensor* result = tensor_create_header(shape, num_dims);
+  if (result == NULL) {
+    return NULL;
+  }
+  if (result->num_elements != tensor->num_elements) {
+    fprintf(stderr, "Error: Shape is not compatible for reshape\n");
+    free(result);
+    return NULL;
+  }
+  if (tensor->storage == NULL) {
+    fprintf(stderr, "Error: Tensor without shared storage cannot be viewed\n");
+    free(result);
+    return NULL;
+  }
+  atomic_fetch_add_explicit(&tensor->storage->refs, 1, memory_order_relaxed);
+  result->storage = tensor->storage;
+  result->data = tensor->data;
+  return result;
+}
+
+// Give a tensor its own storage if shared, copying the data if preserve is set
+int
+tensor_detach(Tensor* tensor, int preserve)
+{
+  TensorStorage* storage = tensor->storage;
+  if (storage == NULL ||
+      atomic_load_explicit(&storage->refs, memory_order_acquire) == 1) {
+    return 0;
+  }
+
+  // Move to fresh storage
+  TensorStorage* copy = tensor_storage_create(tensor->num_elements, 0);
+  if (copy == NULL) {
+    return -1;
+  }
+  if (preserve) {
+    for (size_t i = 0; i < tensor->num_elements; i++) {
+      copy->data[i] = tensor->data[i];
+    }
+  }
+  tensor->storage = copy;
+  tensor->data = copy->data;
+  tensor_storage_release(storage);
+  return 0;
+}
+
+/**
+ * Gives a tensor its own copy of its data if the data is shared.
+ *
+ * Every write to a tensor's data must be preceded by a call to this function,
+ * which the library does for tensor_set_value and the in-place operations.
+ * When the tensor is the only owner of its storage this is a single atomic
+ * load.
+ *
+ * @param tensor The tensor about to be written.
+ * @return 0 on success, or -1 if memory allocation fails.
+ */
+int
+tensor_make_writable(Tensor* tensor)
+{
+  return tensor_detach(tensor, 1);
+}
+
+// Number of elements written per chunk by parallel fills
+#define TENSOR_FILL_GRAIN 65536
+
+// Arguments of a parallel fill
+typedef struct
+{
+  tensor_dtype* data;
+  tensor_dtype value;
+  tensor_dtype step;
+} TensorFill;
+
+// Fill a range with a constant
+static void
+tensor_fill_range(void* arg, size_t begin, size_t end)
+{
+  TensorFill* fill = (TensorFill*)arg;
+  tensor_dtype* data = fill->data;
+  tensor_dtype value = fill->value;
+  for (size_t i = begin; i < end; i++) {
+    data[i] = value;
+  }
+}
+
+// Fill a range with an arithmetic sequence
+static void
+tensor_arange_range(void* arg, size_t begin, size_t end)
+{
+  TensorFill* fill = (TensorFill*)arg;
+  tensor_dtype* data = fill->data;
+  for (size_t i = begin; i < end; i++) {
+    data[i] = fill->value + (tensor_dtype)i * fill->step;
+  }
+}
+
+// Create a new tensor filled with zeros
+Tensor*
+tensor_zeros(const size_t* shape, size_t num_dims)
+{
+  Tensor* tensor = tensor_create_header(shape, num_dims);
+  if (tensor == NULL) {
+    return NULL;
+  }
+  tensor->storage = tensor_storage_create(tensor->num_elements, 1);
+  if (tensor->storage == NULL) {
+    free(tensor);
+    return NULL;
+  }
+  tensor->data = tensor->storage->data;
+  return tensor;
+}
+
+// Create a new tensor filled with a constant
+Tensor*
+tensor_full(const size_t* shape, size_t num_dims, tensor_dtype value)
+{
+  if (value == 0 && !signbit(value)) {
+    return tensor_zeros(shape, num_dims);
+  }
+  Tensor* tensor = tensor_create(shape, num_dims);
+  if (tensor == NULL) {
+    return NULL;
+  }
+  tensor_fill(tensor, value);
+  return tensor;
+}
+
+// Create a new one-dimensional tensor with values from start to stop by step
+Tensor*
+tensor_arange(tensor_dtype start, tensor_dtype stop, tensor_dtype step)
+{
+  // Check if range is valid
+  if (step == 0 || !isfinite(start) || !isfinite(stop) || !isfinite(step)) {
+    fprintf(stderr, "Error: Range is not valid for arange\n");
+    return NULL;
+  }
+  tensor_dtype count = ceil((stop - start) / step);
+  if (!(count < (tensor_dtype)SIZE_MAX)) {
+    fprintf(stderr, "Error: Range is too long for arange\n");
+    return NULL;
+  }
+
+  // Create new tensor for range
+  size_t shape[1] = { count > 0 ? (size_t)count : 0 };
+  Tensor* tensor = tensor_create(shape, 1);
+  if (tensor == NULL) {
+    return NULL;
+  }
+
+  // Compute range
+  TensorFill fill = { tensor->data, start, step };
+  thread_pool_parallel_for(
+    tensor->num_elements, TENSOR_FILL_GRAIN, tensor_arange_range, &fill);
+
+  // Return range
+  return tensor;
+}
+
+// Fill a tensor with a constant in place
+int
+tensor_fill(Tensor* tensor, tensor_dtype value)
+{
+  // Shared data is about to be overwritten, so it is not copied
+  if (tensor_detach(tensor, 0) != 0) {
+    return -1;
+  }
+  TensorFill fill = { tensor->data, value, 0 };
+  thread_pool_parallel_for(
+    tensor->num_elements, TENSOR_FILL_GRAIN, tensor_fill_range, &fill);
+  return 0;
+}
+
+/**
+ * Initializes a small tensor in place.
+ *
+ * The returned tensor points at the shape, strides and data stored inline in
+ * the small tensor, so it can be passed to any function taking a tensor
+ * without touching the heap. It stays valid for as long as the small tensor
+ * does and must not be freed.
+ *
+ * @param small The small tensor to initialize.
+ * @param shape The shape of the tensor.
+ * @param num_dims The number of dimensions of the tensor.
+ * @return A pointer to the embedded tensor, or NULL if the shape does not fit.
+ */
+Tensor*
+tensor_small_init(TensorSmall* small, const size_t* shape, size_t num_dims)
+{
+  // Check if shape fits inline
+  size_t num_elements = 1;
+  for (size_t i = 0; i < num_dims && i < TENSOR_SMALL_MAX_DIMS; i++) {
+    num_elements *= shape[i];
+  }
+  if (num_dims > TENSOR_SMALL_MAX_DIMS ||
+      num_elements > TENSOR_SMALL_MAX_ELEMENTS) {
+    fprintf(stderr, "Error: Shape is too large for a small tensor\n");
+    return NULL;
+  }
+
+  // Point tensor at inline storage
+  Tensor* tensor = &small->tensor;
+  tensor->data = small->data;
+  tensor->storage = NULL;
+  tensor->shape = small->shape;
+  tensor->strides = small->strides;
+  tensor->num_dims = num_dims;
+  tensor->num_elements = 1;
+  for (size_t i = 0; i < num_dims; i++) {
+    tensor->shape[i] = shape[i];
+    tensor->strides[i] = tensor->num_elements;
+    tensor->num_elements *= shape[i];
+  }
+  return tensor;
+}
+
 // Get index of element in tensor
 size_t
 tensor_get_index(const Tensor* tensor, const size_t* indices)
 {
   size_t index = 0;
-  size_t stride = 1;
   for (size_t i = 0; i < tensor->num_dims; i++) {
-    index += indices[i] * stride;
-    stride *= tensor->shape[i];
+    index += indices[i] * tensor->strides[i];
   }
   return index;
 }
 
+/**
+ * Initializes an iterator that walks one or more operands in lockstep.
+ *
+ * Every operand is addressed through its own strides over the common
+ * iteration shape, which lets the same iterator drive element-wise kernels,
+ * reductions (a zero stride on the reduced axis) and permutations. Dimensions
+ * of extent one are dropped and adjacent dimensions that are contiguous for
+ * every operand are collapsed. The first remaining dimension becomes the
+ * inner run, which the caller walks with inner_size and inner_strides; the
+ * rest are advanced by tensor_iter_next with an incremental carry, so no
+ * division or modulo is done per element.
+ *
+ * @param iter The iterator to initialize.
+ * @param shape The iteration shape, innermost dimension first.
+ * @param num_dims The number of dimensions of the iteration shape.
+ * @param num_operands The number of operands, at most TENSOR_ITER_MAX_OPERANDS.
+ * @param strides The strides of each operand over the iteration shape.
+ * @return 0 on success, or -1 if the operands or dimensions are unsupported.
+ */
+int
+tensor_iter_init(TensorIterator* iter,
+                 const size_t* shape,
+                 size_t num_dims,
+                 size_t num_operands,
+                 const size_t* const* strides)
+{
+  if (num_operands > TENSOR_ITER_MAX_OPERANDS || num_dims > TENSOR_MAX_DIMS) {
+    fprintf(stderr, "Error: Iterator has too many operands or dimensions\n");
+    return -1;
+  }
+  iter->num_operands = num_operands;
+  iter->num_dims = 0;
+  iter->done = 0;
+
+  // Collapse the shape into as few dimensions as possible
+  size_t dims = 0;
+  for (size_t d = 0; d < num_dims; d++) {
+    if (shape[d] == 0) {
+      iter->done = 1;
+    }
+    if (shape[d] <= 1) {
+      continue;
+    }
+    int contiguous = dims > 0;
+    for (size_t op = 0; op < num_operands && contiguous; op++) {
+      contiguous = strides[op][d] ==
+                   iter->strides[op][dims - 1] * iter->shape[dims - 1];
+    }
+    if (contiguous) {
+      iter->shape[dims - 1] *= shape[d];
+      continue;
+    }
+    iter->shape[dims] = shape[d];
+    for (size_t op = 0; op < num_operands; op++) {
+      iter->strides[op][dims] = strides[op][d];
+    }
+    dims++;
+  }
+
+  // Split off the first dimension as the inner run
+  if (dims == 0) {
+    iter->inner_size = 1;
+    for (size_t op = 0; op < num_operands; op++) {
+      iter->inner_strides[op] = 0;
+    }
+  } else {
+    iter->inner_size = iter->shape[0];
+    for (size_t op = 0; op < num_operands; op++) {
+      iter->inner_strides[op] = iter->strides[op][0];
+    }
+    for (size_t d = 1; d < dims; d++) {
+      iter->shape[d - 1] = iter->shape[d];
+      for (size_t op = 0; op < num_operands; op++) {
+        iter->strides[op][d - 1] = iter->strides[op][d];
+      }
+    }
+    iter->num_dims = dims - 1;
+  }
+  for (size_t d = 0; d < iter->num_dims; d++) {
+    iter->counter[d] = 0;
+  }
+  for (size_t op = 0; op < num_operands; op++) {
+    iter->offsets[op] = 0;
+  }
+  return 0;
+}
+
+// Advance an iterator to its next inner run
+void
+tensor_iter_next(TensorIterator* iter)
+{
+  for (size_t d = 0; d < iter->num_dims; d++) {
+    if (++iter->counter[d] < iter->shape[d]) {
+      for (size_t op = 0; op < iter->num_operands; op++) {
+        iter->offsets[op] += iter->strides[op][d];
+      }
+      return;
+    }
+    iter->counter[d] = 0;
+    for (size_t op = 0; op < iter->num_operands; op++) {
+      iter->offsets[op] -= iter->strides[op][d] * (iter->shape[d] - 1);
+    }
+  }
+  iter->done = 1;
+}
+
 // Get value of element in tensor
 tensor_dtype
 tensor_get_value(const Tensor* tensor, const size_t* indices)
@@ -84,12 +501,463 @@ tensor_get_value(const Tensor* tensor, const size_t* indices)
 }
 
 // Set value of element in tensor
-tensor_dtype
+int
 tensor_set_value(Tensor* tensor, const size_t* indices, tensor_dtype value)
 {
   size_t index = tensor_get_index(tensor, indices);
+  if (tensor_make_writable(tensor) != 0) {
+    fprintf(stderr, "Error: Unable to copy shared tensor data for writing\n");
+    return -1;
+  }
   tensor->data[index] = value;
-  return value;
+  return 0;
+}
+
+// Apply an activation to a contiguous run of values in place
+void
+tensor_activate(tensor_dtype* values, size_t count, TensorActivation activation)
+{
+  switch (activation) {
+    case TENSOR_ACTIVATION_NONE:
+      break;
+    case TENSOR_ACTIVATION_RELU:
+      for (size_t i = 0; i < count; i++) {
+        values[i] = values[i] > 0 ? values[i] : 0;
+      }
+      break;
+    case TENSOR_ACTIVATION_GELU:
+      for (size_t i = 0; i < count; i++) {
+        values[i] = 0.5 * values[i] * (1.0 + erf(values[i] * M_SQRT1_2));
+      }
+      break;
+    case TENSOR_ACTIVATION_SILU:
+      for (size_t i = 0; i < count; i++) {
+        values[i] = values[i] / (1.0 + exp(-values[i]));
+      }
+      break;
+    case TENSOR_ACTIVATION_TANH:
+      for (size_t i = 0; i < count; i++) {
+        values[i] = tanh(values[i]);
+      }
+      break;
+  }
+}
+
+// Signature of a GEMM micro-kernel
+typedef void (*TensorGemmTile)(size_t tile_m,
+                               size_t tile_n,
+                               size_t k_len,
+                               const tensor_dtype* a,
+                               size_t lda,
+                               const tensor_dtype* b,
+                               size_t ldb,
+                               tensor_dtype* c,
+                               size_t ldc,
+                               int accumulate,
+                               const tensor_dtype* bias,
+                               TensorActivation activation,
+                               int last);
+
+/**
+ * Generates a micro-kernel computing one register tile of C = A * B over a
+ * slice of the K dimension.
+ *
+ * All matrices are column-major. The tile is at most MR by NR and is held in
+ * a local accumulator for the whole K loop, fully unrolled for the full tile
+ * size. When the slice is the last one, the bias and activation are applied
+ * to the accumulator before it is stored, so the epilogue costs no extra pass
+ * over C. The kernel takes the tile size, the K slice length, A, B and C with
+ * their leading dimensions, whether to add to C, the bias of the tile's first
+ * column or NULL, the activation, and whether this is the last K slice.
+ */
+#define TENSOR_GEMM_TILE(MR, NR)                                               \
+  static void tensor_gemm_tile_##MR##x##NR(size_t tile_m,                      \
+                                           size_t tile_n,                      \
+                                           size_t k_len,                       \
+                                           const tensor_dtype* a,              \
+                                           size_t lda,                         \
+                                           const tensor_dtype* b,              \
+                                           size_t ldb,                         \
+                                           tensor_dtype* c,                    \
+                                           size_t ldc,                         \
+                                           int accumulate,                     \
+                                           const tensor_dtype* bias,           \
+                                           TensorActivation activation,        \
+                                           int last)                           \
+  {                                                                            \
+    tensor_dtype acc[NR][MR] = { { 0 } };                                      \
+                                                                               \
+    /* Load partial sums from previous K slices */                             \
+    if (accumulate) {                                                          \
+      for (size_t j = 0; j < tile_n; j++) {                                    \
+        for (size_t i = 0; i < tile_m; i++) {                                  \
+          acc[j][i] = c[i + j * ldc];                                          \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    /* Accumulate the tile, unrolled for the full tile size */                 \
+    if (tile_m == MR && tile_n == NR) {                                        \
+      for (size_t p = 0; p < k_len; p++) {                                     \
+        const tensor_dtype* a_col = a + p * lda;                               \
+        _Pragma("GCC unroll 8") for (size_t j = 0; j < NR; j++)                \
+        {                                                                      \
+          tensor_dtype b_value = b[p + j * ldb];                               \
+          _Pragma("GCC unroll 8") for (size_t i = 0; i < MR; i++)              \
+          {                                                                    \
+            acc[j][i] += a_col[i] * b_value;                                   \
+          }                                                                    \
+        }                                                                      \
+      }                                                                        \
+    } else {                                                                   \
+      for (size_t p = 0; p < k_len; p++) {                                     \
+        for (size_t j = 0; j < tile_n; j++) {                                  \
+          tensor_dtype b_value = b[p + j * ldb];                               \
+          for (size_t i = 0; i < tile_m; i++) {                                \
+            acc[j][i] += a[i + p * lda] * b_value;                             \
+          }                                                                    \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    /* Apply the epilogue while the tile is still local */                     \
+    if (last) {                                                                \
+      if (bias != NULL) {                                                      \
+        for (size_t j = 0; j < tile_n; j++) {                                  \
+          for (size_t i = 0; i < tile_m; i++) {                                \
+            acc[j][i] += bias[j];                                              \
+          }                                                                    \
+        }                                                                      \
+      }                                                                        \
+      for (size_t j = 0; j < tile_n; j++) {                                    \
+        tensor_activate(acc[j], tile_m, activation);                           \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    /* Store the tile */                                                       \
+    for (size_t j = 0; j < tile_n; j++) {                                      \
+      for (size_t i = 0; i < tile_m; i++) {                                    \
+        c[i + j * ldc] = acc[j][i];                                            \
+      }                                                                        \
+    }                                                                          \
+  }
+
+TENSOR_GEMM_TILE(4, 4)
+TENSOR_GEMM_TILE(8, 4)
+TENSOR_GEMM_TILE(4, 8)
+
+// Micro-kernels and their tile sizes, indexed by TensorGemmKernel
+static const struct
+{
+  TensorGemmTile tile;
+  size_t tile_m;
+  size_t tile_n;
+} tensor_gemm_kernels[] = { { tensor_gemm_tile_4x4, 4, 4 },
+                            { tensor_gemm_tile_8x4, 8, 4 },
+                            { tensor_gemm_tile_4x8, 4, 8 } };
+
+// Number of bits of each block size in the packed GEMM configuration
+#define TENSOR_GEMM_BLOCK_BITS 20
+
+// Configuration of the GEMM packed into one word, so that every matrix
+// multiplication reads it with a single atomic load, or 0 until first use
+static _Atomic uint64_t tensor_gemm_current;
+
+// Pack a GEMM configuration into one word
+static uint64_t
+tensor_gemm_pack(const TensorGemmConfig* config)
+{
+  return (uint64_t)config->block_m |
+         (uint64_t)config->block_n << TENSOR_GEMM_BLOCK_BITS |
+         (uint64_t)config->block_k << 2 * TENSOR_GEMM_BLOCK_BITS |
+         (uint64_t)config->kernel << 3 * TENSOR_GEMM_BLOCK_BITS;
+}
+
+// Check that a GEMM configuration is usable and fits its packed form
+static int
+tensor_gemm_config_valid(const TensorGemmConfig* config)
+{
+  size_t limit = (size_t)1 << TENSOR_GEMM_BLOCK_BITS;
+  return config->block_m > 0 && config->block_n > 0 && config->block_k > 0 &&
+         config->block_m < limit && config->block_n < limit &&
+         config->block_k < limit &&
+         (size_t)config->kernel <
+           sizeof(tensor_gemm_kernels) / sizeof(tensor_gemm_kernels[0]);
+}
+
+// Get the configuration used by matrix multiplications
+TensorGemmConfig
+tensor_gemm_config(void)
+{
+  // Load the tuning file, or else the cache heuristics, once on first use
+  // unless a configuration was set first
+  uint64_t packed =
+    atomic_load_explicit(&tensor_gemm_current, memory_order_relaxed);
+  if (packed == 0) {
+    TensorGemmConfig startup = tensor_autotune_startup_config();
+    if (!tensor_gemm_config_valid(&startup)) {
+      startup = tensor_autotune_heuristic();
+    }
+    uint64_t expected = 0;
+    packed = tensor_gemm_pack(&startup);
+    if (!atomic_compare_exchange_strong(
+          &tensor_gemm_current, &expected, packed)) {
+      packed = expected;
+    }
+  }
+
+  // Unpack configuration
+  uint64_t mask = ((uint64_t)1 << TENSOR_GEMM_BLOCK_BITS) - 1;
+  TensorGemmConfig config = {
+    (size_t)(packed & mask),
+    (size_t)(packed >> TENSOR_GEMM_BLOCK_BITS & mask),
+    (size_t)(packed >> 2 * TENSOR_GEMM_BLOCK_BITS & mask),
+    (TensorGemmKernel)(packed >> 3 * TENSOR_GEMM_BLOCK_BITS)
+  };
+  return config;
+}
+
+/**
+ * Sets the configuration used by matrix multiplications.
+ *
+ * The configuration replaces the one loaded from the tuning file at startup
+ * and applies to every matrix multiplication started afterwards. Block
+ * sizes must be below 2^20.
+ *
+ * @param config The block sizes and micro-kernel to use.
+ * @return 0 on success, or -1 if the configuration is invalid.
+ */
+int
+tensor_set_gemm_config(const TensorGemmConfig* config)
+{
+  // Check if configuration is valid
+  if (!tensor_gemm_config_valid(config)) {
+    fprintf(stderr, "Error: Invalid GEMM configuration\n");
+    return -1;
+  }
+  atomic_store_explicit(
+    &tensor_gemm_current, tensor_gemm_pack(config), memory_order_relaxed);
+  return 0;
+}
+
+/**
+ * Computes C = activation(A * B + bias) for column-major matrices.
+ *
+ * A is m by k, B is k by n and C is m by n. The bias, if given, has one entry
+ * per column of C. The loop nest is blocked for cache reuse with the block
+ * sizes and micro-kernel of the current configuration, and the epilogue is
+ * fused into the final K slice of each register tile.
+ *
+ * @param m The number of rows of A and C.
+ * @param n The number of columns of B and C.
+ * @param k The number of columns of A and rows of B.
+ * @param a The data of A.
+ * @param b The data of B.
+ * @param c The data of C.
+ * @param bias The bias with n entries, or NULL.
+ * @param activation The activation to apply, or TENSOR_ACTIVATION_NONE.
+ */
+void
+tensor_gemm(size_t m,
+            size_t n,
+            size_t k,
+            const tensor_dtype* a,
+            const tensor_dtype* b,
+            tensor_dtype* c,
+            const tensor_dtype* bias,
+            TensorActivation activation)
+{
+  // An empty inner dimension still needs the epilogue on a zero product
+  if (k == 0) {
+    for (size_t j = 0; j < n; j++) {
+      for (size_t i = 0; i < m; i++) {
+        c[i + j * m] = bias != NULL ? bias[j] : 0;
+      }
+      tensor_activate(c + j * m, m, activation);
+    }
+    return;
+  }
+
+  TensorGemmConfig config = tensor_gemm_config();
+  TensorGemmTile tile = tensor_gemm_kernels[config.kernel].tile;
+  size_t mr = tensor_gemm_kernels[config.kernel].tile_m;
+  size_t nr = tensor_gemm_kernels[config.kernel].tile_n;
+  for (size_t jc = 0; jc < n; jc += config.block_n) {
+    size_t n_len = n - jc < config.block_n ? n - jc : config.block_n;
+    for (size_t pc = 0; pc < k; pc += config.block_k) {
+      size_t k_len = k - pc < config.block_k ? k - pc : config.block_k;
+      int last = pc + k_len == k;
+      for (size_t ic = 0; ic < m; ic += config.block_m) {
+        size_t m_len = m - ic < config.block_m ? m - ic : config.block_m;
+        for (size_t jr = 0; jr < n_len; jr += nr) {
+          size_t tile_n = n_len - jr < nr ? n_len - jr : nr;
+          size_t col = jc + jr;
+          for (size_t ir = 0; ir < m_len; ir += mr) {
+            size_t tile_m = m_len - ir < mr ? m_len - ir : mr;
+            size_t row = ic + ir;
+            tile(tile_m,
+                 tile_n,
+                 k_len,
+                 a + row + pc * m,
+                 m,
+                 b + pc + col * k,
+                 k,
+                 c + row + col * m,
+                 m,
+                 pc > 0,
+                 bias != NULL ? bias + col : NULL,
+                 activation,
+                 last);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Generate a fully unrolled N by N times N by N matrix multiplication
+#define TENSOR_SMALL_MATMUL(N)                                                 \
+  static void tensor_small_matmul_##N(                                         \
+    const tensor_dtype* a, const tensor_dtype* b, tensor_dtype* c)             \
+  {                                                                            \
+    _Pragma("GCC unroll 4") for (size_t j = 0; j < N; j++)                     \
+    {                                                                          \
+      _Pragma("GCC unroll 4") for (size_t i = 0; i < N; i++)                   \
+      {                                                                        \
+        tensor_dtype value = 0;                                                \
+        _Pragma("GCC unroll 4") for (size_t k = 0; k < N; k++)                 \
+        {                                                                      \
+          value += a[i + k * N] * b[k + j * N];                                \
+        }                                                                      \
+        c[i + j * N] = value;                                                  \
+      }                                                                        \
+    }                                                                          \
+  }
+
+// Generate a fully unrolled N by N times N by 1 matrix-vector product
+#define TENSOR_SMALL_MATVEC(N)                                                 \
+  static void tensor_small_matvec_##N(                                         \
+    const tensor_dtype* a, const tensor_dtype* b, tensor_dtype* c)             \
+  {                                                                            \
+    _Pragma("GCC unroll 4") for (size_t i = 0; i < N; i++)                     \
+    {                                                                          \
+      tensor_dtype value = 0;                                                  \
+      _Pragma("GCC unroll 4") for (size_t k = 0; k < N; k++)                   \
+      {                                                                        \
+        value += a[i + k * N] * b[k];                                          \
+      }                                                                        \
+      c[i] = value;                                                            \
+    }                                                                          \
+  }
+
+// Generate a fully unrolled N by N transpose
+#define TENSOR_SMALL_TRANSPOSE(N)                                              \
+  static void tensor_small_transpose_##N(const tensor_dtype* a,                \
+                                         tensor_dtype* c)                      \
+  {                                                                            \
+    _Pragma("GCC unroll 4") for (size_t j = 0; j < N; j++)                     \
+    {                                                                          \
+      _Pragma("GCC unroll 4") for (size_t i = 0; i < N; i++)                   \
+      {                                                                        \
+        c[j + i * N] = a[i + j * N];                                           \
+      }                                                                        \
+    }                                                                          \
+  }
+
+// Generate a fully unrolled element-wise sum of N elements
+#define TENSOR_SMALL_ADD(N)                                                    \
+  static void tensor_small_add_##N(                                            \
+    const tensor_dtype* a, const tensor_dtype* b, tensor_dtype* c)             \
+  {                                                                            \
+    _Pragma("GCC unroll 16") for (size_t i = 0; i < N; i++)                    \
+    {                                                                          \
+      c[i] = a[i] + b[i];                                                      \
+    }                                                                          \
+  }
+
+// Specialized kernels for the common fixed small shapes
+TENSOR_SMALL_MATMUL(2)
+TENSOR_SMALL_MATMUL(3)
+TENSOR_SMALL_MATMUL(4)
+TENSOR_SMALL_MATVEC(2)
+TENSOR_SMALL_MATVEC(3)
+TENSOR_SMALL_MATVEC(4)
+TENSOR_SMALL_TRANSPOSE(2)
+TENSOR_SMALL_TRANSPOSE(3)
+TENSOR_SMALL_TRANSPOSE(4)
+TENSOR_SMALL_ADD(2)
+TENSOR_SMALL_ADD(3)
+TENSOR_SMALL_ADD(4)
+TENSOR_SMALL_ADD(9)
+TENSOR_SMALL_ADD(16)
+
+// Compute an element-wise sum, dispatching small sizes to unrolled kernels
+static void
+tensor_add_kernel(const Tensor* tensor1, const Tensor* tensor2, Tensor* result)
+{
+  const tensor_dtype* a = tensor1->data;
+  const tensor_dtype* b = tensor2->data;
+  tensor_dtype* c = result->data;
+  switch (result->num_elements) {
+    case 2:
+      tensor_small_add_2(a, b, c);
+      return;
+    case 3:
+      tensor_small_add_3(a, b, c);
+      return;
+    case 4:
+      tensor_small_add_4(a, b, c);
+      return;
+    case 9:
+      tensor_small_add_9(a, b, c);
+      return;
+    case 16:
+      tensor_small_add_16(a, b, c);
+      return;
+  }
+  for (size_t i = 0; i < result->num_elements; i++) {
+    c[i] = a[i] + b[i];
+  }
+}
+
+// Compute a matrix product, dispatching small square shapes to unrolled kernels
+static void
+tensor_matmul_kernel(const Tensor* tensor1,
+                     const Tensor* tensor2,
+                     Tensor* result)
+{
+  size_t m = tensor1->shape[0];
+  size_t n = tensor2->shape[1];
+  size_t k = tensor1->shape[1];
+  const tensor_dtype* a = tensor1->data;
+  const tensor_dtype* b = tensor2->data;
+  tensor_dtype* c = result->data;
+  if (m == k && (n == k || n == 1)) {
+    switch (k) {
+      case 2:
+        if (n == 1) {
+          tensor_small_matvec_2(a, b, c);
+        } else {
+          tensor_small_matmul_2(a, b, c);
+        }
+        return;
+      case 3:
+        if (n == 1) {
+          tensor_small_matvec_3(a, b, c);
+        } else {
+          tensor_small_matmul_3(a, b, c);
+        }
+        return;
+      case 4:
+        if (n == 1) {
+          tensor_small_matvec_4(a, b, c);
+        } else {
+          tensor_small_matmul_4(a, b, c);
+        }
+        return;
+    }
+  }
+  tensor_gemm(m, n, k, a, b, c, NULL, TENSOR_ACTIVATION_NONE);
 }
 
 // Pretty print tensor
@@ -108,13 +976,8 @@ tensor_print(const Tensor* tensor)
 
   // Print tensor data
   printf("Tensor data:\n");
-  size_t* indices = (size_t*)malloc(tensor->num_dims * sizeof(size_t));
+  size_t indices[TENSOR_MAX_DIMS] = { 0 };
   for (size_t i = 0; i < tensor->num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims; j++) {
-      indices[j] = remainder % tensor->shape[j];
-      remainder /= tensor->shape[j];
-    }
     printf("(");
     for (size_t j = 0; j < tensor->num_dims; j++) {
       printf("%zu", indices[j]);
@@ -122,9 +985,16 @@ tensor_print(const Tensor* tensor)
         printf(", ");
       }
     }
-    printf("): %f\n", tensor_get_value(tensor, indices));
+    printf("): %f\n", tensor->data[i]);
+
+    // Advance indices with carry
+    for (size_t j = 0; j < tensor->num_dims; j++) {
+      if (++indices[j] < tensor->shape[j]) {
+        break;
+      }
+      indices[j] = 0;
+    }
   }
-  free(indices);
 }
 
 // Check if two tensors are the same shape
@@ -176,16 +1046,14 @@ tensor_dot(const Tensor* tensor1, const Tensor* tensor2)
   }
 
   // Compute dot product
-  for (size_t i = 0; i < tensor1->shape[0]; i++) {
-    for (size_t j = 0; j < tensor2->shape[1]; j++) {
-      tensor_dtype value = 0;
-      for (size_t k = 0; k < tensor1->shape[1]; k++) {
-        value += tensor_get_value(tensor1, (size_t[]){ i, k }) *
-                 tensor_get_value(tensor2, (size_t[]){ k, j });
-      }
-      tensor_set_value(tensor, (size_t[]){ i, j }, value);
-    }
-  }
+  tensor_gemm(tensor1->shape[0],
+              tensor2->shape[1],
+              tensor1->shape[1],
+              tensor1->data,
+              tensor2->data,
+              tensor->data,
+              NULL,
+              TENSOR_ACTIVATION_NONE);
 
   // Return dot product
   return tensor;
@@ -208,14 +1076,34 @@ tensor_add(const Tensor* tensor1, const Tensor* tensor2)
   }
 
   // Compute element-wise sum
-  for (size_t i = 0; i < tensor1->num_elements; i++) {
-    tensor->data[i] = tensor1->data[i] + tensor2->data[i];
-  }
+  tensor_add_kernel(tensor1, tensor2, tensor);
 
   // Return element-wise sum
   return tensor;
 }
 
+// Compute the element-wise sum of two tensors into an existing tensor
+Tensor*
+tensor_add_into(const Tensor* tensor1, const Tensor* tensor2, Tensor* result)
+{
+  // Check if tensors are compatible for element-wise sum
+  if (!tensor_same_shape(tensor1, tensor2) ||
+      !tensor_same_shape(tensor1, result)) {
+    fprintf(stderr, "Error: Tensors are not compatible for element-wise sum\n");
+    return NULL;
+  }
+
+  if (tensor_make_writable(result) != 0) {
+    return NULL;
+  }
+
+  // Compute element-wise sum
+  tensor_add_kernel(tensor1, tensor2, result);
+
+  // Return element-wise sum
+  return result;
+}
+
 // Compute the element-wise difference of two tensors
 Tensor*
 tensor_subtract(const Tensor* tensor1, const Tensor* tensor2)
@@ -418,13 +1306,61 @@ tensor_tan(const Tensor* tensor)
     return NULL;
   }
 
-  // Compute element-wise tangent
-  for (size_t i = 0; i < tensor->num_elements; i++) {
-    result->data[i] = tan(tensor->data[i]);
-  }
+  // Compute element-wise tangent
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    result->data[i] = tan(tensor->data[i]);
+  }
+
+  // Return element-wise tangent
+  return result;
+}
+
+// Compute the element-wise activation of a tensor
+Tensor*
+tensor_activation(const Tensor* tensor, TensorActivation activation)
+{
+  // Create new tensor for element-wise activation
+  Tensor* result = tensor_create(tensor->shape, tensor->num_dims);
+  if (result == NULL) {
+    return NULL;
+  }
+
+  // Compute element-wise activation
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    result->data[i] = tensor->data[i];
+  }
+  tensor_activate(result->data, result->num_elements, activation);
+
+  // Return element-wise activation
+  return result;
+}
+
+// Compute the element-wise rectified linear unit of a tensor
+Tensor*
+tensor_relu(const Tensor* tensor)
+{
+  return tensor_activation(tensor, TENSOR_ACTIVATION_RELU);
+}
+
+// Compute the element-wise Gaussian error linear unit of a tensor
+Tensor*
+tensor_gelu(const Tensor* tensor)
+{
+  return tensor_activation(tensor, TENSOR_ACTIVATION_GELU);
+}
+
+// Compute the element-wise sigmoid linear unit of a tensor
+Tensor*
+tensor_silu(const Tensor* tensor)
+{
+  return tensor_activation(tensor, TENSOR_ACTIVATION_SILU);
+}
 
-  // Return element-wise tangent
-  return result;
+// Compute the element-wise hyperbolic tangent of a tensor
+Tensor*
+tensor_tanh(const Tensor* tensor)
+{
+  return tensor_activation(tensor, TENSOR_ACTIVATION_TANH);
 }
 
 // Compute the multiplication of a tensor by a scalar
@@ -504,27 +1440,185 @@ tensor_matmul(const Tensor* tensor1, const Tensor* tensor2)
   }
 
   // Compute matrix multiplication
-  for (size_t i = 0; i < tensor1->shape[0]; i++) {
-    for (size_t j = 0; j < tensor2->shape[1]; j++) {
-      tensor_dtype value = 0;
-      for (size_t k = 0; k < tensor1->shape[1]; k++) {
-        value += tensor_get_value(tensor1, (size_t[]){ i, k }) *
-                 tensor_get_value(tensor2, (size_t[]){ k, j });
-      }
-      tensor_set_value(tensor, (size_t[]){ i, j }, value);
-    }
+  tensor_matmul_kernel(tensor1, tensor2, tensor);
+
+  // Return matrix multiplication
+  return tensor;
+}
+
+// Compute the matrix multiplication of two tensors into an existing tensor
+Tensor*
+tensor_matmul_into(const Tensor* tensor1,
+                   const Tensor* tensor2,
+                   Tensor* result)
+{
+  // Check if tensors are compatible for matrix multiplication
+  if (tensor1->num_dims != 2 || tensor2->num_dims != 2 ||
+      tensor1->shape[1] != tensor2->shape[0] || result->num_dims != 2 ||
+      result->shape[0] != tensor1->shape[0] ||
+      result->shape[1] != tensor2->shape[1]) {
+    fprintf(stderr,
+            "Error: Tensors are not compatible for matrix multiplication\n");
+    return NULL;
+  }
+  if (tensor_make_writable(result) != 0) {
+    return NULL;
   }
+  if (result->data == tensor1->data || result->data == tensor2->data) {
+    fprintf(stderr, "Error: Matrix multiplication cannot run in place\n");
+    return NULL;
+  }
+
+  // Compute matrix multiplication
+  tensor_matmul_kernel(tensor1, tensor2, result);
 
   // Return matrix multiplication
+  return result;
+}
+
+// Arguments of a parallel batched matrix multiplication
+typedef struct
+{
+  const Tensor* tensor1;
+  const Tensor* tensor2;
+  Tensor* result;
+} TensorBatchMatmul;
+
+// Multiply a range of batch slices
+static void
+tensor_batch_matmul_range(void* arg, size_t begin, size_t end)
+{
+  TensorBatchMatmul* batch = (TensorBatchMatmul*)arg;
+  size_t m = batch->tensor1->shape[0];
+  size_t k = batch->tensor1->shape[1];
+  size_t n = batch->tensor2->shape[1];
+  for (size_t b = begin; b < end; b++) {
+    tensor_gemm(m,
+                n,
+                k,
+                batch->tensor1->data + b * batch->tensor1->strides[2],
+                batch->tensor2->data + b * batch->tensor2->strides[2],
+                batch->result->data + b * batch->result->strides[2],
+                NULL,
+                TENSOR_ACTIVATION_NONE);
+  }
+}
+
+// Compute the matrix multiplication of each pair of slices along the last axis
+Tensor*
+tensor_batch_matmul(const Tensor* tensor1, const Tensor* tensor2)
+{
+  // Check if tensors are compatible for batched matrix multiplication
+  if (tensor1->num_dims != 3 || tensor2->num_dims != 3 ||
+      tensor1->shape[1] != tensor2->shape[0] ||
+      tensor1->shape[2] != tensor2->shape[2]) {
+    fprintf(
+      stderr,
+      "Error: Tensors are not compatible for batched matrix multiplication\n");
+    return NULL;
+  }
+
+  // Create new tensor for batched matrix multiplication
+  size_t shape[3] = { tensor1->shape[0], tensor2->shape[1], tensor1->shape[2] };
+  Tensor* tensor = tensor_create(shape, 3);
+  if (tensor == NULL) {
+    return NULL;
+  }
+
+  // Compute batched matrix multiplication, one slice per task
+  TensorBatchMatmul batch = { tensor1, tensor2, tensor };
+  thread_pool_parallel_for(shape[2], 1, tensor_batch_matmul_range, &batch);
+
+  // Return batched matrix multiplication
+  return tensor;
+}
+
+// Compute a dense layer: matmul plus optional bias, then an activation
+Tensor*
+tensor_linear(const Tensor* input,
+              const Tensor* weight,
+              const Tensor* bias,
+              TensorActivation activation)
+{
+  // Check if tensors are compatible for a dense layer
+  if (input->num_dims != 2 || weight->num_dims != 2 ||
+      input->shape[1] != weight->shape[0]) {
+    fprintf(stderr, "Error: Tensors are not compatible for dense layer\n");
+    return NULL;
+  }
+  if (bias != NULL &&
+      (bias->num_dims != 1 || bias->shape[0] != weight->shape[1])) {
+    fprintf(stderr, "Error: Bias is not compatible for dense layer\n");
+    return NULL;
+  }
+
+  // Create new tensor for dense layer
+  size_t shape[2] = { input->shape[0], weight->shape[1] };
+  Tensor* tensor = tensor_create(shape, 2);
+  if (tensor == NULL) {
+    return NULL;
+  }
+
+  // Compute dense layer with the bias and activation fused into the GEMM
+  tensor_gemm(input->shape[0],
+              weight->shape[1],
+              input->shape[1],
+              input->data,
+              weight->data,
+              tensor->data,
+              bias != NULL ? bias->data : NULL,
+              activation);
+
+  // Return dense layer
   return tensor;
 }
 
+// Compute a transpose into a tensor of the reversed shape
+static void
+tensor_transpose_kernel(const Tensor* tensor, Tensor* result)
+{
+  // Dispatch small square matrices to unrolled kernels
+  if (tensor->num_dims == 2 && tensor->shape[0] == tensor->shape[1]) {
+    switch (tensor->shape[0]) {
+      case 2:
+        tensor_small_transpose_2(tensor->data, result->data);
+        return;
+      case 3:
+        tensor_small_transpose_3(tensor->data, result->data);
+        return;
+      case 4:
+        tensor_small_transpose_4(tensor->data, result->data);
+        return;
+    }
+  }
+
+  // Walk the input with the reversed output strides
+  size_t strides[TENSOR_MAX_DIMS];
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    strides[i] = result->strides[tensor->num_dims - i - 1];
+  }
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   tensor->shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t dst_stride = iter.inner_strides[1];
+    for (size_t i = 0; i < iter.inner_size; i++) {
+      dst[i * dst_stride] = src[i];
+    }
+  }
+}
+
 // Compute the transpose of a tensor
 Tensor*
 tensor_transpose(const Tensor* tensor)
 {
   // Create new tensor for transpose
-  size_t shape[tensor->num_dims];
+  size_t shape[TENSOR_MAX_DIMS];
   for (size_t i = 0; i < tensor->num_dims; i++) {
     shape[i] = tensor->shape[tensor->num_dims - i - 1];
   }
@@ -534,70 +1628,103 @@ tensor_transpose(const Tensor* tensor)
   }
 
   // Compute transpose
-  size_t indices[tensor->num_dims];
-  for (size_t i = 0; i < tensor->num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims; j++) {
-      indices[j] = remainder % tensor->shape[j];
-      remainder /= tensor->shape[j];
-    }
-    for (size_t j = 0; j < tensor->num_dims; j++) {
-      indices[j] = shape[j] - indices[j] - 1;
-    }
-    tensor_set_value(result, indices, tensor->data[i]);
-  }
+  tensor_transpose_kernel(tensor, result);
 
   // Return transpose
   return result;
 }
 
-// Compute the sum of a tensor along a given axis
+// Compute the transpose of a tensor into an existing tensor
 Tensor*
-tensor_sum(const Tensor* tensor, size_t axis)
+tensor_transpose_into(const Tensor* tensor, Tensor* result)
 {
-  // Check if axis is valid
-  if (axis >= tensor->num_dims) {
-    fprintf(stderr, "Error: Axis is out of bounds\n");
+  // Check if result has the reversed shape
+  int compatible = tensor->num_dims == result->num_dims;
+  for (size_t i = 0; compatible && i < tensor->num_dims; i++) {
+    compatible = result->shape[i] == tensor->shape[tensor->num_dims - i - 1];
+  }
+  if (!compatible) {
+    fprintf(stderr, "Error: Tensors are not compatible for transpose\n");
+    return NULL;
+  }
+  if (tensor_make_writable(result) != 0) {
+    return NULL;
+  }
+  if (result->data == tensor->data) {
+    fprintf(stderr, "Error: Transpose cannot run in place\n");
     return NULL;
   }
 
-  // Compute sum along axis
-  size_t shape[tensor->num_dims - 1];
-  size_t num_elements = 1;
-  for (size_t i = 0, j = 0; i < tensor->num_dims; i++) {
-    if (i != axis) {
-      shape[j] = tensor->shape[i];
-      num_elements *= tensor->shape[i];
-      j++;
+  // Compute transpose
+  tensor_transpose_kernel(tensor, result);
+
+  // Return transpose
+  return result;
+}
+
+// Compute a tensor with its axes reordered
+Tensor*
+tensor_permute(const Tensor* tensor, const size_t* axes)
+{
+  // Check if axes are a permutation
+  int seen[TENSOR_MAX_DIMS] = { 0 };
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    if (axes[i] >= tensor->num_dims || seen[axes[i]]) {
+      fprintf(stderr, "Error: Axes are not a permutation\n");
+      return NULL;
     }
+    seen[axes[i]] = 1;
   }
-  Tensor* result = tensor_create(shape, tensor->num_dims - 1);
+
+  // Create new tensor for permutation
+  size_t shape[TENSOR_MAX_DIMS];
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    shape[i] = tensor->shape[axes[i]];
+  }
+  Tensor* result = tensor_create(shape, tensor->num_dims);
   if (result == NULL) {
     return NULL;
   }
-  size_t indices[tensor->num_dims];
-  for (size_t i = 0; i < num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims - 1; j++) {
-      indices[j] = remainder % shape[j];
-      remainder /= shape[j];
-    }
-    indices[axis] = 0;
-    tensor_dtype value = 0;
-    for (size_t j = 0; j < tensor->shape[axis]; j++) {
-      indices[axis] = j;
-      value += tensor_get_value(tensor, indices);
+
+  // Compute permutation by walking the input with the permuted output strides
+  size_t strides[TENSOR_MAX_DIMS];
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    strides[axes[i]] = result->strides[i];
+  }
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   tensor->shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t dst_stride = iter.inner_strides[1];
+    for (size_t i = 0; i < iter.inner_size; i++) {
+      dst[i * dst_stride] = src[i];
     }
-    tensor_set_value(result, indices, value);
   }
 
-  // Return sum along axis
+  // Return permutation
   return result;
 }
 
-// Compute the mean of a tensor along a given axis
-Tensor*
-tensor_mean(const Tensor* tensor, size_t axis)
+/**
+ * Creates the result of a reduction along an axis.
+ *
+ * The result has the input's shape with the axis removed. The strides of the
+ * result over the input's shape are written to out_strides, with a zero
+ * stride on the reduced axis, so that a tensor iterator over the input visits
+ * every input element together with the result element it reduces into.
+ *
+ * @param tensor The tensor being reduced.
+ * @param axis The axis to reduce along.
+ * @param out_strides Receives the result strides over the input's shape.
+ * @return The uninitialized result, or NULL on error.
+ */
+static Tensor*
+tensor_reduce_create(const Tensor* tensor, size_t axis, size_t* out_strides)
 {
   // Check if axis is valid
   if (axis >= tensor->num_dims) {
@@ -605,35 +1732,112 @@ tensor_mean(const Tensor* tensor, size_t axis)
     return NULL;
   }
 
-  // Compute mean along axis
-  size_t shape[tensor->num_dims - 1];
-  size_t num_elements = 1;
+  // Create new tensor without the reduced axis
+  size_t shape[TENSOR_MAX_DIMS];
   for (size_t i = 0, j = 0; i < tensor->num_dims; i++) {
     if (i != axis) {
-      shape[j] = tensor->shape[i];
-      num_elements *= tensor->shape[i];
-      j++;
+      shape[j++] = tensor->shape[i];
     }
   }
   Tensor* result = tensor_create(shape, tensor->num_dims - 1);
   if (result == NULL) {
     return NULL;
   }
-  size_t indices[tensor->num_dims];
-  for (size_t i = 0; i < num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims - 1; j++) {
-      indices[j] = remainder % shape[j];
-      remainder /= shape[j];
+
+  // Broadcast the result along the reduced axis
+  for (size_t i = 0, j = 0; i < tensor->num_dims; i++) {
+    out_strides[i] = i == axis ? 0 : result->strides[j++];
+  }
+  return result;
+}
+
+// Initialize a reduction result with the first slice along the axis
+static int
+tensor_reduce_first(const Tensor* tensor,
+                    size_t axis,
+                    Tensor* result,
+                    const size_t* out_strides)
+{
+  if (tensor->shape[axis] == 0) {
+    fprintf(stderr, "Error: Axis is empty\n");
+    return -1;
+  }
+  size_t shape[TENSOR_MAX_DIMS];
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    shape[i] = i == axis ? 1 : tensor->shape[i];
+  }
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, out_strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t src_stride = iter.inner_strides[0];
+    size_t dst_stride = iter.inner_strides[1];
+    for (size_t i = 0; i < iter.inner_size; i++) {
+      dst[i * dst_stride] = src[i * src_stride];
     }
-    indices[axis] = 0;
-    tensor_dtype value = 0;
-    for (size_t j = 0; j < tensor->shape[axis]; j++) {
-      indices[axis] = j;
-      value += tensor_get_value(tensor, indices);
+  }
+  return 0;
+}
+
+// Compute the sum of a tensor along a given axis
+Tensor*
+tensor_sum(const Tensor* tensor, size_t axis)
+{
+  size_t out_strides[TENSOR_MAX_DIMS];
+  Tensor* result = tensor_reduce_create(tensor, axis, out_strides);
+  if (result == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < result->num_elements; i++) {
+    result->data[i] = 0;
+  }
+
+  // Compute sum along axis
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   tensor->shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, out_strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t src_stride = iter.inner_strides[0];
+    if (iter.inner_strides[1] == 0) {
+      tensor_dtype value = *dst;
+      for (size_t i = 0; i < iter.inner_size; i++) {
+        value += src[i * src_stride];
+      }
+      *dst = value;
+    } else {
+      size_t dst_stride = iter.inner_strides[1];
+      for (size_t i = 0; i < iter.inner_size; i++) {
+        dst[i * dst_stride] += src[i * src_stride];
+      }
     }
-    value /= tensor->shape[axis];
-    tensor_set_value(result, indices, value);
+  }
+
+  // Return sum along axis
+  return result;
+}
+
+// Compute the mean of a tensor along a given axis
+Tensor*
+tensor_mean(const Tensor* tensor, size_t axis)
+{
+  // Compute mean along axis
+  Tensor* result = tensor_sum(tensor, axis);
+  if (result == NULL) {
+    return NULL;
+  }
+  tensor_dtype count = (tensor_dtype)tensor->shape[axis];
+  for (size_t i = 0; i < result->num_elements; i++) {
+    result->data[i] /= count;
   }
 
   // Return mean along axis
@@ -644,40 +1848,39 @@ tensor_mean(const Tensor* tensor, size_t axis)
 Tensor*
 tensor_max(const Tensor* tensor, size_t axis)
 {
-  // Check if axis is valid
-  if (axis >= tensor->num_dims) {
-    fprintf(stderr, "Error: Axis is out of bounds\n");
+  size_t out_strides[TENSOR_MAX_DIMS];
+  Tensor* result = tensor_reduce_create(tensor, axis, out_strides);
+  if (result == NULL) {
     return NULL;
   }
-
-  // Compute maximum along axis
-  size_t shape[tensor->num_dims - 1];
-  size_t num_elements = 1;
-  for (size_t i = 0, j = 0; i < tensor->num_dims; i++) {
-    if (i != axis) {
-      shape[j] = tensor->shape[i];
-      num_elements *= tensor->shape[i];
-      j++;
-    }
-  }
-  Tensor* result = tensor_create(shape, tensor->num_dims - 1);
-  if (result == NULL) {
+  if (tensor_reduce_first(tensor, axis, result, out_strides) != 0) {
+    tensor_free(result);
     return NULL;
   }
-  size_t indices[tensor->num_dims];
-  for (size_t i = 0; i < num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims - 1; j++) {
-      indices[j] = remainder % shape[j];
-      remainder /= shape[j];
-    }
-    indices[axis] = 0;
-    tensor_dtype value = tensor_get_value(tensor, indices);
-    for (size_t j = 0; j < tensor->shape[axis]; j++) {
-      indices[axis] = j;
-      value = fmax(value, tensor_get_value(tensor, indices));
+
+  // Compute maximum along axis
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   tensor->shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, out_strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t src_stride = iter.inner_strides[0];
+    if (iter.inner_strides[1] == 0) {
+      tensor_dtype value = *dst;
+      for (size_t i = 0; i < iter.inner_size; i++) {
+        value = fmax(value, src[i * src_stride]);
+      }
+      *dst = value;
+    } else {
+      size_t dst_stride = iter.inner_strides[1];
+      for (size_t i = 0; i < iter.inner_size; i++) {
+        dst[i * dst_stride] = fmax(dst[i * dst_stride], src[i * src_stride]);
+      }
     }
-    tensor_set_value(result, indices, value);
   }
 
   // Return maximum along axis
@@ -688,40 +1891,39 @@ tensor_max(const Tensor* tensor, size_t axis)
 Tensor*
 tensor_min(const Tensor* tensor, size_t axis)
 {
-  // Check if axis is valid
-  if (axis >= tensor->num_dims) {
-    fprintf(stderr, "Error: Axis is out of bounds\n");
+  size_t out_strides[TENSOR_MAX_DIMS];
+  Tensor* result = tensor_reduce_create(tensor, axis, out_strides);
+  if (result == NULL) {
     return NULL;
   }
-
-  // Compute minimum along axis
-  size_t shape[tensor->num_dims - 1];
-  size_t num_elements = 1;
-  for (size_t i = 0, j = 0; i < tensor->num_dims; i++) {
-    if (i != axis) {
-      shape[j] = tensor->shape[i];
-      num_elements *= tensor->shape[i];
-      j++;
-    }
-  }
-  Tensor* result = tensor_create(shape, tensor->num_dims - 1);
-  if (result == NULL) {
+  if (tensor_reduce_first(tensor, axis, result, out_strides) != 0) {
+    tensor_free(result);
     return NULL;
   }
-  size_t indices[tensor->num_dims];
-  for (size_t i = 0; i < num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims - 1; j++) {
-      indices[j] = remainder % shape[j];
-      remainder /= shape[j];
-    }
-    indices[axis] = 0;
-    tensor_dtype value = tensor_get_value(tensor, indices);
-    for (size_t j = 0; j < tensor->shape[axis]; j++) {
-      indices[axis] = j;
-      value = fmin(value, tensor_get_value(tensor, indices));
+
+  // Compute minimum along axis
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   tensor->shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, out_strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = tensor->data + iter.offsets[0];
+    tensor_dtype* dst = result->data + iter.offsets[1];
+    size_t src_stride = iter.inner_strides[0];
+    if (iter.inner_strides[1] == 0) {
+      tensor_dtype value = *dst;
+      for (size_t i = 0; i < iter.inner_size; i++) {
+        value = fmin(value, src[i * src_stride]);
+      }
+      *dst = value;
+    } else {
+      size_t dst_stride = iter.inner_strides[1];
+      for (size_t i = 0; i < iter.inner_size; i++) {
+        dst[i * dst_stride] = fmin(dst[i * dst_stride], src[i * src_stride]);
+      }
     }
-    tensor_set_value(result, indices, value);
   }
 
   // Return minimum along axis
@@ -732,55 +1934,365 @@ tensor_min(const Tensor* tensor, size_t axis)
 Tensor*
 tensor_mode(const Tensor* tensor, size_t axis)
 {
-  // Check if axis is valid
-  if (axis >= tensor->num_dims) {
-    fprintf(stderr, "Error: Axis is out of bounds\n");
+  size_t out_strides[TENSOR_MAX_DIMS];
+  Tensor* result = tensor_reduce_create(tensor, axis, out_strides);
+  if (result == NULL) {
     return NULL;
   }
-
-  // Compute mode along axis
-  size_t shape[tensor->num_dims - 1];
-  size_t num_elements = 1;
-  for (size_t i = 0, j = 0; i < tensor->num_dims; i++) {
-    if (i != axis) {
-      shape[j] = tensor->shape[i];
-      num_elements *= tensor->shape[i];
-      j++;
-    }
+  if (tensor_reduce_first(tensor, axis, result, out_strides) != 0) {
+    tensor_free(result);
+    return NULL;
   }
-  Tensor* result = tensor_create(shape, tensor->num_dims - 1);
-  if (result == NULL) {
+
+  // Track the current run of each output element alongside the result
+  size_t count = result->num_elements;
+  tensor_dtype* values = (tensor_dtype*)malloc(count * sizeof(tensor_dtype));
+  size_t* counts = (size_t*)malloc(2 * count * sizeof(size_t));
+  if (values == NULL || counts == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for tensor mode\n");
+    free(values);
+    free(counts);
+    tensor_free(result);
     return NULL;
   }
-  size_t indices[tensor->num_dims];
-  for (size_t i = 0; i < num_elements; i++) {
-    size_t remainder = i;
-    for (size_t j = 0; j < tensor->num_dims - 1; j++) {
-      indices[j] = remainder % shape[j];
-      remainder /= shape[j];
-    }
-    indices[axis] = 0;
-    tensor_dtype value = tensor_get_value(tensor, indices);
-    size_t count = 1;
-    size_t max_count = 1;
-    tensor_dtype mode = value;
-    for (size_t j = 1; j < tensor->shape[axis]; j++) {
-      indices[axis] = j;
-      tensor_dtype next_value = tensor_get_value(tensor, indices);
-      if (next_value == value) {
-        count++;
+  size_t* max_counts = counts + count;
+  for (size_t i = 0; i < count; i++) {
+    values[i] = result->data[i];
+    counts[i] = 1;
+    max_counts[i] = 1;
+  }
+
+  // Compute mode along axis, starting after the first slice
+  size_t shape[TENSOR_MAX_DIMS];
+  for (size_t i = 0; i < tensor->num_dims; i++) {
+    shape[i] = tensor->shape[i] - (i == axis);
+  }
+  const tensor_dtype* data = tensor->data + tensor->strides[axis];
+  TensorIterator iter;
+  tensor_iter_init(&iter,
+                   shape,
+                   tensor->num_dims,
+                   2,
+                   (const size_t* const[]){ tensor->strides, out_strides });
+  for (; !iter.done; tensor_iter_next(&iter)) {
+    const tensor_dtype* src = data + iter.offsets[0];
+    size_t src_stride = iter.inner_strides[0];
+    size_t dst_stride = iter.inner_strides[1];
+    for (size_t i = 0; i < iter.inner_size; i++) {
+      size_t out = iter.offsets[1] + i * dst_stride;
+      tensor_dtype next_value = src[i * src_stride];
+      if (next_value == values[out]) {
+        counts[out]++;
       } else {
-        value = next_value;
-        count = 1;
+        values[out] = next_value;
+        counts[out] = 1;
       }
-      if (count > max_count) {
-        max_count = count;
-        mode = value;
+      if (counts[out] > max_counts[out]) {
+        max_counts[out] = counts[out];
+        result->data[out] = next_value;
       }
     }
-    tensor_set_value(result, indices, mode);
   }
+  free(values);
+  free(counts);
 
   // Return mode along axis
   return result;
-}
\ No newline at end of file
+}
+
+// Number of elements per work item of a scan
+#define TENSOR_SCAN_CHUNK 8192
+
+// Number of columns of a block scanned together along a non-innermost axis
+#define TENSOR_SCAN_WIDTH 256
+
+// Shared state of a scan along an axis
+typedef struct
+{
+  const tensor_dtype* src;
+  tensor_dtype* dst;
+  size_t inner;
+  size_t length;
+  size_t num_blocks;
+  size_t chunk_length;
+  size_t num_chunks;
+  size_t width;
+  tensor_dtype* totals;
+} TensorScan;
+
+// Combine operations of the scans
+#define TENSOR_SCAN_SUM(a, b) ((a) + (b))
+#define TENSOR_SCAN_PROD(a, b) ((a) * (b))
+#define TENSOR_SCAN_MAX(a, b) fmax(a, b)
+#define TENSOR_SCAN_MIN(a, b) fmin(a, b)
+
+/**
+ * Generates the three phases of a scan with a combine operation.
+ *
+ * The scan views the tensor as inner by length by outer elements and scans
+ * along the middle dimension. A line is one block of at most
+ * TENSOR_SCAN_WIDTH contiguous columns, and a work item is one chunk of
+ * chunk_length steps of a line. The reduce phase writes the total of every
+ * chunk but the last, with four accumulators along a contiguous axis and
+ * column-wise otherwise so that both forms vectorize. The prefix phase turns
+ * the totals of each line into running totals. The downsweep phase scans
+ * each chunk from the running total of the chunks before it, streaming whole
+ * column blocks down the axis when the axis is not innermost.
+ */
+#define TENSOR_SCAN_PHASES(NAME, OP)                                           \
+  static void tensor_scan_reduce_##NAME(void* arg, size_t begin, size_t end)   \
+  {                                                                            \
+    TensorScan* scan = (TensorScan*)arg;                                       \
+    for (size_t item = begin; item < end; item++) {                            \
+      size_t chunk = item % scan->num_chunks;                                  \
+      size_t line = item / scan->num_chunks;                                   \
+      size_t block = line % scan->num_blocks;                                  \
+      size_t col = block * TENSOR_SCAN_WIDTH;                                  \
+      size_t width = scan->inner - col < TENSOR_SCAN_WIDTH                     \
+                       ? scan->inner - col                                     \
+                       : TENSOR_SCAN_WIDTH;                                    \
+      size_t step = chunk * scan->chunk_length;                                \
+      size_t steps = scan->length - step < scan->chunk_length                  \
+                       ? scan->length - step                                   \
+                       : scan->chunk_length;                                   \
+      if (chunk + 1 == scan->num_chunks) {                                     \
+        continue;                                                              \
+      }                                                                        \
+      const tensor_dtype* src = scan->src +                                    \
+                                line / scan->num_blocks * scan->inner *        \
+                                  scan->length +                               \
+                                step * scan->inner + col;                      \
+      tensor_dtype* total = scan->totals + item * scan->width;                 \
+      if (width == 1) {                                                        \
+        tensor_dtype acc[4] = { src[0], src[0], src[0], src[0] };              \
+        size_t t = 1;                                                          \
+        if (steps >= 4) {                                                      \
+          acc[1] = src[1];                                                     \
+          acc[2] = src[2];                                                     \
+          acc[3] = src[3];                                                     \
+          for (t = 4; t + 4 <= steps; t += 4) {                                \
+            acc[0] = OP(acc[0], src[t]);                                       \
+            acc[1] = OP(acc[1], src[t + 1]);                                   \
+            acc[2] = OP(acc[2], src[t + 2]);                                   \
+            acc[3] = OP(acc[3], src[t + 3]);                                   \
+          }                                                                    \
+          acc[0] = OP(OP(acc[0], acc[1]), OP(acc[2], acc[3]));                 \
+        }                                                                      \
+        for (; t < steps; t++) {                                               \
+          acc[0] = OP(acc[0], src[t]);                                         \
+        }                                                                      \
+        total[0] = acc[0];                                                     \
+      } else {                                                                 \
+        for (size_t j = 0; j < width; j++) {                                   \
+          total[j] = src[j];                                                   \
+        }                                                                      \
+        for (size_t t = 1; t < steps; t++) {                                   \
+          const tensor_dtype* row = src + t * scan->inner;                     \
+          for (size_t j = 0; j < width; j++) {                                 \
+            total[j] = OP(total[j], row[j]);                                   \
+          }                                                                    \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void tensor_scan_prefix_##NAME(void* arg, size_t begin, size_t end)   \
+  {                                                                            \
+    TensorScan* scan = (TensorScan*)arg;                                       \
+    for (size_t line = begin; line < end; line++) {                            \
+      size_t col = line % scan->num_blocks * TENSOR_SCAN_WIDTH;                \
+      size_t width = scan->inner - col < TENSOR_SCAN_WIDTH                     \
+                       ? scan->inner - col                                     \
+                       : TENSOR_SCAN_WIDTH;                                    \
+      tensor_dtype* totals =                                                   \
+        scan->totals + line * scan->num_chunks * scan->width;                  \
+      for (size_t chunk = 1; chunk + 1 < scan->num_chunks; chunk++) {          \
+        const tensor_dtype* prefix = totals + (chunk - 1) * scan->width;       \
+        tensor_dtype* total = totals + chunk * scan->width;                    \
+        for (size_t j = 0; j < width; j++) {                                   \
+          total[j] = OP(prefix[j], total[j]);                                  \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void tensor_scan_chunk_##NAME(void* arg, size_t begin, size_t end)    \
+  {                                                                            \
+    TensorScan* scan = (TensorScan*)arg;                                       \
+    for (size_t item = begin; item < end; item++) {                            \
+      size_t chunk = item % scan->num_chunks;                                  \
+      size_t line = item / scan->num_chunks;                                   \
+      size_t block = line % scan->num_blocks;                                  \
+      size_t col = block * TENSOR_SCAN_WIDTH;                                  \
+      size_t width = scan->inner - col < TENSOR_SCAN_WIDTH                     \
+                       ? scan->inner - col                                     \
+                       : TENSOR_SCAN_WIDTH;                                    \
+      size_t step = chunk * scan->chunk_length;                                \
+      size_t steps = scan->length - step < scan->chunk_length                  \
+                       ? scan->length - step                                   \
+                       : scan->chunk_length;                                   \
+      size_t offset = line / scan->num_blocks * scan->inner * scan->length +   \
+                      step * scan->inner + col;                                \
+      const tensor_dtype* src = scan->src + offset;                            \
+      tensor_dtype* dst = scan->dst + offset;                                  \
+                                                                               \
+      /* Seed the chunk with the prefix of the chunks before it */             \
+      size_t t = 0;                                                            \
+      const tensor_dtype* prev = dst;                                          \
+      if (chunk == 0) {                                                        \
+        for (size_t j = 0; j < width; j++) {                                   \
+          dst[j] = src[j];                                                     \
+        }                                                                      \
+        t = 1;                                                                 \
+      } else {                                                                 \
+        prev = scan->totals + (item - 1) * scan->width;                        \
+      }                                                                        \
+      if (width == 1) {                                                        \
+        tensor_dtype acc = prev[0];                                            \
+        for (; t < steps; t++) {                                               \
+          acc = OP(acc, src[t]);                                               \
+          dst[t] = acc;                                                        \
+        }                                                                      \
+      } else {                                                                 \
+        for (; t < steps; t++) {                                               \
+          const tensor_dtype* row = src + t * scan->inner;                     \
+          tensor_dtype* out = dst + t * scan->inner;                           \
+          for (size_t j = 0; j < width; j++) {                                 \
+            out[j] = OP(prev[j], row[j]);                                      \
+          }                                                                    \
+          prev = out;                                                          \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }
+
+TENSOR_SCAN_PHASES(sum, TENSOR_SCAN_SUM)
+TENSOR_SCAN_PHASES(prod, TENSOR_SCAN_PROD)
+TENSOR_SCAN_PHASES(max, TENSOR_SCAN_MAX)
+TENSOR_SCAN_PHASES(min, TENSOR_SCAN_MIN)
+
+/**
+ * Computes an inclusive scan of a tensor along an axis.
+ *
+ * Long axes are split into chunks of about TENSOR_SCAN_CHUNK elements and
+ * scanned in three phases: the chunks are reduced in parallel, the chunk
+ * totals of each line are turned into running totals, and the chunks are
+ * scanned in parallel from the running totals. The chunking depends
+ * only on the shape, so results are identical for any number of threads.
+ * Along a non-innermost axis, blocks of contiguous columns are scanned
+ * together so that every step reads and writes whole cache lines.
+ *
+ * @param tensor The tensor to scan.
+ * @param axis The axis to scan along.
+ * @param reduce The reduce phase of the combine operation.
+ * @param prefix The prefix phase of the combine operation.
+ * @param downsweep The downsweep phase of the combine operation.
+ * @return A pointer to the new tensor, or NULL if an error occurs.
+ */
+static Tensor*
+tensor_scan(const Tensor* tensor,
+            size_t axis,
+            ThreadPoolRangeTask reduce,
+            ThreadPoolRangeTask prefix,
+            ThreadPoolRangeTask downsweep)
+{
+  // Check if axis is valid
+  if (axis >= tensor->num_dims) {
+    fprintf(stderr, "Error: Axis is out of bounds\n");
+    return NULL;
+  }
+
+  // Create new tensor for scan
+  Tensor* result = tensor_create(tensor->shape, tensor->num_dims);
+  if (result == NULL || result->num_elements == 0) {
+    return result;
+  }
+
+  // Split the tensor into lines of column blocks, and the lines into chunks
+  TensorScan scan;
+  scan.src = tensor->data;
+  scan.dst = result->data;
+  scan.inner = tensor->strides[axis];
+  scan.length = tensor->shape[axis];
+  scan.num_blocks = (scan.inner + TENSOR_SCAN_WIDTH - 1) / TENSOR_SCAN_WIDTH;
+  scan.width = scan.inner < TENSOR_SCAN_WIDTH ? scan.inner : TENSOR_SCAN_WIDTH;
+  scan.chunk_length =
+    TENSOR_SCAN_CHUNK / scan.width > 0 ? TENSOR_SCAN_CHUNK / scan.width : 1;
+  scan.num_chunks = (scan.length + scan.chunk_length - 1) / scan.chunk_length;
+  size_t num_lines =
+    tensor->num_elements / (scan.inner * scan.length) * scan.num_blocks;
+  size_t num_items = num_lines * scan.num_chunks;
+  size_t item_size =
+    scan.width *
+    (scan.length < scan.chunk_length ? scan.length : scan.chunk_length);
+  size_t grain = (TENSOR_SCAN_CHUNK + item_size - 1) / item_size;
+  scan.totals = NULL;
+
+  // Reduce the chunks and turn their totals into running totals
+  if (scan.num_chunks > 1) {
+    scan.totals =
+      (tensor_dtype*)malloc(num_items * scan.width * sizeof(tensor_dtype));
+    if (scan.totals == NULL) {
+      fprintf(stderr, "Error: Unable to allocate memory for tensor scan\n");
+      tensor_free(result);
+      return NULL;
+    }
+    thread_pool_parallel_for(num_items, grain, reduce, &scan);
+    thread_pool_parallel_for(num_lines,
+                             (TENSOR_SCAN_CHUNK + scan.num_chunks - 1) /
+                               scan.num_chunks,
+                             prefix,
+                             &scan);
+  }
+
+  // Compute scan along axis
+  thread_pool_parallel_for(num_items, grain, downsweep, &scan);
+  free(scan.totals);
+
+  // Return scan along axis
+  return result;
+}
+
+// Compute the cumulative sum of a tensor along a given axis
+Tensor*
+tensor_cumsum(const Tensor* tensor, size_t axis)
+{
+  return tensor_scan(tensor,
+                     axis,
+                     tensor_scan_reduce_sum,
+                     tensor_scan_prefix_sum,
+                     tensor_scan_chunk_sum);
+}
+
+// Compute the cumulative product of a tensor along a given axis
+Tensor*
+tensor_cumprod(const Tensor* tensor, size_t axis)
+{
+  return tensor_scan(tensor,
+                     axis,
+                     tensor_scan_reduce_prod,
+                     tensor_scan_prefix_prod,
+                     tensor_scan_chunk_prod);
+}
+
+// Compute the running maximum of a tensor along a given axis
+Tensor*
+tensor_cummax(const Tensor* tensor, size_t axis)
+{
+  return tensor_scan(tensor,
+                     axis,
+                     tensor_scan_reduce_max,
+                     tensor_scan_prefix_max,
+                     tensor_scan_chunk_max);
+}
+
+// Compute the running minimum of a tensor along a given axis
+Tensor*
+tensor_cummin(const Tensor* tensor, size_t axis)
+{
+  return tensor_scan(tensor,
+                     axis,
+                     tensor_scan_reduce_min,
+                     tensor_scan_prefix_min,
+                     tensor_scan_chunk_min);
+}
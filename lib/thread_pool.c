@@ -0,0 +1,275 @@
+// Includes
+#include "../includes/thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Queued task of the thread pool
+typedef struct ThreadPoolJob
+{
+  ThreadPoolTask task;
+  void* arg;
+  struct ThreadPoolJob* next;
+} ThreadPoolJob;
+
+// Shared state of a parallel for loop
+typedef struct
+{
+  ThreadPoolRangeTask task;
+  void* arg;
+  size_t count;
+  size_t grain;
+  size_t num_chunks;
+  atomic_size_t next_chunk;
+  atomic_size_t refs;
+  size_t done_chunks;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} ThreadPoolLoop;
+
+// Thread pool state, started lazily on first use
+static atomic_int thread_pool_started = 0;
+static int thread_pool_atfork_registered = 0;
+static pthread_mutex_t thread_pool_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t thread_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_pool_cond = PTHREAD_COND_INITIALIZER;
+static ThreadPoolJob* thread_pool_head = NULL;
+static ThreadPoolJob* thread_pool_tail = NULL;
+static size_t thread_pool_threads = 0;
+
+// Run queued tasks forever
+static void*
+thread_pool_worker(void* unused)
+{
+  (void)unused;
+  for (;;) {
+    pthread_mutex_lock(&thread_pool_mutex);
+    while (thread_pool_head == NULL) {
+      pthread_cond_wait(&thread_pool_cond, &thread_pool_mutex);
+    }
+    ThreadPoolJob* job = thread_pool_head;
+    thread_pool_head = job->next;
+    if (thread_pool_head == NULL) {
+      thread_pool_tail = NULL;
+    }
+    pthread_mutex_unlock(&thread_pool_mutex);
+
+    job->task(job->arg);
+    free(job);
+  }
+  return NULL;
+}
+
+// Forget the workers of the parent in a forked child, which has none
+static void
+thread_pool_atfork_child(void)
+{
+  pthread_mutex_init(&thread_pool_start_mutex, NULL);
+  pthread_mutex_init(&thread_pool_mutex, NULL);
+  pthread_cond_init(&thread_pool_cond, NULL);
+  thread_pool_head = NULL;
+  thread_pool_tail = NULL;
+  thread_pool_threads = 0;
+  atomic_store(&thread_pool_started, 0);
+}
+
+// Start one detached worker per online processor, or TENSOR_NUM_THREADS
+static void
+thread_pool_start(void)
+{
+  if (!thread_pool_atfork_registered) {
+    pthread_atfork(NULL, NULL, thread_pool_atfork_child);
+    thread_pool_atfork_registered = 1;
+  }
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* env = getenv("TENSOR_NUM_THREADS");
+  if (env != NULL && atol(env) > 0) {
+    online = atol(env);
+  }
+  size_t wanted = online > 0 ? (size_t)online : 1;
+  for (size_t i = 0; i < wanted; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, thread_pool_worker, NULL) != 0) {
+      break;
+    }
+    pthread_detach(thread);
+    thread_pool_threads++;
+  }
+  if (thread_pool_threads == 0) {
+    fprintf(stderr, "Error: Unable to start thread pool workers\n");
+  }
+}
+
+// Get the number of worker threads in the thread pool
+size_t
+thread_pool_num_threads(void)
+{
+  if (!atomic_load_explicit(&thread_pool_started, memory_order_acquire)) {
+    pthread_mutex_lock(&thread_pool_start_mutex);
+    if (!atomic_load_explicit(&thread_pool_started, memory_order_relaxed)) {
+      thread_pool_start();
+      atomic_store_explicit(&thread_pool_started, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&thread_pool_start_mutex);
+  }
+  return thread_pool_threads;
+}
+
+/**
+ * Runs a task asynchronously on the thread pool.
+ *
+ * Tasks are started in submission order by the first idle worker. The pool
+ * is started on first use with one worker per online processor, or with
+ * TENSOR_NUM_THREADS workers when that environment variable is set. A forked
+ * child process starts a pool of its own on first use.
+ *
+ * @param task The task to run.
+ * @param arg The argument passed to the task.
+ * @return 0 on success, or -1 if the task could not be queued.
+ */
+int
+thread_pool_submit(ThreadPoolTask task, void* arg)
+{
+  if (thread_pool_num_threads() == 0) {
+    return -1;
+  }
+  ThreadPoolJob* job = (ThreadPoolJob*)malloc(sizeof(ThreadPoolJob));
+  if (job == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for thread pool job\n");
+    return -1;
+  }
+  job->task = task;
+  job->arg = arg;
+  job->next = NULL;
+
+  pthread_mutex_lock(&thread_pool_mutex);
+  if (thread_pool_tail == NULL) {
+    thread_pool_head = job;
+  } else {
+    thread_pool_tail->next = job;
+  }
+  thread_pool_tail = job;
+  pthread_cond_signal(&thread_pool_cond);
+  pthread_mutex_unlock(&thread_pool_mutex);
+  return 0;
+}
+
+// Drop a reference to a parallel for loop
+static void
+thread_pool_loop_release(ThreadPoolLoop* loop)
+{
+  if (atomic_fetch_sub(&loop->refs, 1) == 1) {
+    pthread_mutex_destroy(&loop->mutex);
+    pthread_cond_destroy(&loop->cond);
+    free(loop);
+  }
+}
+
+// Claim and run chunks of a parallel for loop until none are left
+static void
+thread_pool_loop_run(ThreadPoolLoop* loop)
+{
+  size_t done = 0;
+  for (;;) {
+    size_t chunk = atomic_fetch_add(&loop->next_chunk, 1);
+    if (chunk >= loop->num_chunks) {
+      break;
+    }
+    size_t begin = chunk * loop->grain;
+    size_t end = begin + loop->grain < loop->count ? begin + loop->grain
+                                                   : loop->count;
+    loop->task(loop->arg, begin, end);
+    done++;
+  }
+  if (done > 0) {
+    pthread_mutex_lock(&loop->mutex);
+    loop->done_chunks += done;
+    if (loop->done_chunks == loop->num_chunks) {
+      pthread_cond_signal(&loop->cond);
+    }
+    pthread_mutex_unlock(&loop->mutex);
+  }
+}
+
+// Run a parallel for loop from a pool worker
+static void
+thread_pool_loop_helper(void* arg)
+{
+  ThreadPoolLoop* loop = (ThreadPoolLoop*)arg;
+  thread_pool_loop_run(loop);
+  thread_pool_loop_release(loop);
+}
+
+/**
+ * Runs a range task over [0, count) in parallel and waits for it to finish.
+ *
+ * The range is split into chunks of grain indices which are claimed
+ * dynamically by the calling thread and by pool workers. The caller always
+ * takes part, so the loop makes progress even when every worker is busy,
+ * including when it is called from inside another pool task. Chunk
+ * boundaries depend only on count and grain, never on the number of threads.
+ *
+ * @param count The number of indices.
+ * @param grain The number of indices per chunk.
+ * @param task The task to run on each chunk.
+ * @param arg The argument passed to the task.
+ */
+void
+thread_pool_parallel_for(size_t count,
+                         size_t grain,
+                         ThreadPoolRangeTask task,
+                         void* arg)
+{
+  if (count == 0) {
+    return;
+  }
+  if (grain == 0) {
+    grain = 1;
+  }
+  size_t num_chunks = (count + grain - 1) / grain;
+  size_t threads = thread_pool_num_threads();
+
+  // Run serially when there is nothing to share
+  ThreadPoolLoop* loop = NULL;
+  if (num_chunks > 1 && threads > 1) {
+    loop = (ThreadPoolLoop*)malloc(sizeof(ThreadPoolLoop));
+  }
+  if (loop == NULL) {
+    for (size_t begin = 0; begin < count; begin += grain) {
+      task(arg, begin, begin + grain < count ? begin + grain : count);
+    }
+    return;
+  }
+
+  loop->task = task;
+  loop->arg = arg;
+  loop->count = count;
+  loop->grain = grain;
+  loop->num_chunks = num_chunks;
+  atomic_init(&loop->next_chunk, 0);
+  atomic_init(&loop->refs, 1);
+  loop->done_chunks = 0;
+  pthread_mutex_init(&loop->mutex, NULL);
+  pthread_cond_init(&loop->cond, NULL);
+
+  // Wake helpers, each holding a reference in case it starts late
+  size_t helpers = num_chunks - 1 < threads ? num_chunks - 1 : threads;
+  for (size_t i = 0; i < helpers; i++) {
+    atomic_fetch_add(&loop->refs, 1);
+    if (thread_pool_submit(thread_pool_loop_helper, loop) != 0) {
+      atomic_fetch_sub(&loop->refs, 1);
+      break;
+    }
+  }
+
+  // Take part, then wait for chunks claimed by helpers
+  thread_pool_loop_run(loop);
+  pthread_mutex_lock(&loop->mutex);
+  while (loop->done_chunks < loop->num_chunks) {
+    pthread_cond_wait(&loop->cond, &loop->mutex);
+  }
+  pthread_mutex_unlock(&loop->mutex);
+  thread_pool_loop_release(loop);
+}
@@ -1,7 +1,21 @@
 // Includes
 #include <assert.h>
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include "../includes/autotune.h"
+#include "../includes/collective.h"
+#include "../includes/compress.h"
+#include "../includes/einsum.h"
+#include "../includes/index.h"
+#include "../includes/plan.h"
+#include "../includes/random.h"
+#include "../includes/stream.h"
 #include "../includes/tensor.h"
 
 // Test tensor_create function
@@ -19,11 +33,1075 @@ test_tensor_create()
   tensor_free(tensor);
 }
 
+// Test tensor_matmul function
+void
+test_tensor_matmul()
+{
+  // Use sizes that are not multiples of the GEMM tile to cover edge tiles
+  size_t shape1[2] = { 7, 5 };
+  size_t shape2[2] = { 5, 6 };
+  Tensor* tensor1 = tensor_create(shape1, 2);
+  Tensor* tensor2 = tensor_create(shape2, 2);
+  for (size_t i = 0; i < tensor1->num_elements; i++) {
+    tensor1->data[i] = (tensor_dtype)(i % 4) - 1.5;
+  }
+  for (size_t i = 0; i < tensor2->num_elements; i++) {
+    tensor2->data[i] = (tensor_dtype)(i % 3) + 0.5;
+  }
+  Tensor* result = tensor_matmul(tensor1, tensor2);
+  assert(result != NULL);
+  assert(result->shape[0] == 7 && result->shape[1] == 6);
+  for (size_t i = 0; i < 7; i++) {
+    for (size_t j = 0; j < 6; j++) {
+      tensor_dtype expected = 0;
+      for (size_t k = 0; k < 5; k++) {
+        expected += tensor_get_value(tensor1, (size_t[]){ i, k }) *
+                    tensor_get_value(tensor2, (size_t[]){ k, j });
+      }
+      assert(fabs(tensor_get_value(result, (size_t[]){ i, j }) - expected) <
+             1e-12);
+    }
+  }
+  tensor_free(tensor1);
+  tensor_free(tensor2);
+  tensor_free(result);
+}
+
+// Test GEMM configurations and the autotuner
+void
+test_tensor_autotune()
+{
+  // Small blocks split every dimension, including partial K slices
+  size_t shape1[2] = { 19, 23 };
+  size_t shape2[2] = { 23, 17 };
+  Tensor* tensor1 = tensor_create(shape1, 2);
+  Tensor* tensor2 = tensor_create(shape2, 2);
+  for (size_t i = 0; i < tensor1->num_elements; i++) {
+    tensor1->data[i] = (tensor_dtype)(i % 5) - 2;
+  }
+  for (size_t i = 0; i < tensor2->num_elements; i++) {
+    tensor2->data[i] = (tensor_dtype)(i % 7) * 0.5;
+  }
+  TensorGemmConfig original = tensor_gemm_config();
+  for (int kernel = TENSOR_GEMM_KERNEL_4X4; kernel <= TENSOR_GEMM_KERNEL_4X8;
+       kernel++) {
+    TensorGemmConfig config = { 12, 8, 10, (TensorGemmKernel)kernel };
+    assert(tensor_set_gemm_config(&config) == 0);
+    assert(tensor_gemm_config().kernel == (TensorGemmKernel)kernel);
+    Tensor* result = tensor_matmul(tensor1, tensor2);
+    for (size_t i = 0; i < 19; i++) {
+      for (size_t j = 0; j < 17; j++) {
+        tensor_dtype expected = 0;
+        for (size_t k = 0; k < 23; k++) {
+          expected += tensor1->data[i + k * 19] * tensor2->data[k + j * 23];
+        }
+        assert(result->data[i + j * 19] == expected);
+      }
+    }
+    tensor_free(result);
+  }
+  TensorGemmConfig invalid = { 0, 8, 8, TENSOR_GEMM_KERNEL_4X4 };
+  assert(tensor_set_gemm_config(&invalid) == -1);
+
+  // The tuned configuration is saved and loaded back for this machine
+  const char* path = "/tmp/tensor_test_gemm.tune";
+  TensorGemmConfig best;
+  assert(tensor_autotune(path, &best) == 0);
+  assert(tensor_set_gemm_config(&original) == 0);
+  assert(tensor_autotune_load(path) == 0);
+  TensorGemmConfig loaded = tensor_gemm_config();
+  assert(loaded.block_m == best.block_m && loaded.block_n == best.block_n &&
+         loaded.block_k == best.block_k && loaded.kernel == best.kernel);
+  remove(path);
+  assert(tensor_autotune_load(path) == -1);
+
+  assert(tensor_set_gemm_config(&original) == 0);
+  tensor_free(tensor1);
+  tensor_free(tensor2);
+}
+
+// Test tensor_linear function
+void
+test_tensor_linear()
+{
+  size_t input_shape[2] = { 5, 3 };
+  size_t weight_shape[2] = { 3, 6 };
+  size_t bias_shape[1] = { 6 };
+  Tensor* input = tensor_create(input_shape, 2);
+  Tensor* weight = tensor_create(weight_shape, 2);
+  Tensor* bias = tensor_create(bias_shape, 1);
+  for (size_t i = 0; i < input->num_elements; i++) {
+    input->data[i] = (tensor_dtype)i * 0.25 - 1.0;
+  }
+  for (size_t i = 0; i < weight->num_elements; i++) {
+    weight->data[i] = (tensor_dtype)(i % 5) - 2.0;
+  }
+  for (size_t i = 0; i < bias->num_elements; i++) {
+    bias->data[i] = (tensor_dtype)i - 3.0;
+  }
+
+  // The fused layer must match the unfused matmul, bias and activation
+  Tensor* product = tensor_matmul(input, weight);
+  for (size_t i = 0; i < 5; i++) {
+    for (size_t j = 0; j < 6; j++) {
+      size_t indices[2] = { i, j };
+      assert(tensor_set_value(product,
+                              indices,
+                              tensor_get_value(product, indices) +
+                                bias->data[j]) == 0);
+    }
+  }
+  TensorActivation activations[5] = { TENSOR_ACTIVATION_NONE,
+                                      TENSOR_ACTIVATION_RELU,
+                                      TENSOR_ACTIVATION_GELU,
+                                      TENSOR_ACTIVATION_SILU,
+                                      TENSOR_ACTIVATION_TANH };
+  for (size_t a = 0; a < 5; a++) {
+    Tensor* fused = tensor_linear(input, weight, bias, activations[a]);
+    Tensor* expected = tensor_activation(product, activations[a]);
+    assert(fused != NULL && expected != NULL);
+    for (size_t i = 0; i < fused->num_elements; i++) {
+      assert(fabs(fused->data[i] - expected->data[i]) < 1e-12);
+    }
+    tensor_free(fused);
+    tensor_free(expected);
+  }
+
+  // Spot check the standalone activations
+  Tensor* relu = tensor_relu(product);
+  for (size_t i = 0; i < relu->num_elements; i++) {
+    assert(relu->data[i] == (product->data[i] > 0 ? product->data[i] : 0));
+  }
+  assert(tensor_linear(weight, weight, NULL, TENSOR_ACTIVATION_NONE) == NULL);
+
+  tensor_free(relu);
+  tensor_free(product);
+  tensor_free(input);
+  tensor_free(weight);
+  tensor_free(bias);
+}
+
+// Test tensor_transpose function
+void
+test_tensor_transpose()
+{
+  size_t shape[3] = { 2, 3, 4 };
+  Tensor* tensor = tensor_create(shape, 3);
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    tensor->data[i] = (tensor_dtype)i;
+  }
+  Tensor* result = tensor_transpose(tensor);
+  assert(result != NULL);
+  assert(result->shape[0] == 4 && result->shape[1] == 3 &&
+         result->shape[2] == 2);
+  for (size_t i = 0; i < 2; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      for (size_t k = 0; k < 4; k++) {
+        assert(tensor_get_value(result, (size_t[]){ k, j, i }) ==
+               tensor_get_value(tensor, (size_t[]){ i, j, k }));
+      }
+    }
+  }
+  tensor_free(tensor);
+  tensor_free(result);
+}
+
+// Test reductions along every axis
+void
+test_tensor_reductions()
+{
+  size_t shape[3] = { 3, 4, 5 };
+  Tensor* tensor = tensor_create(shape, 3);
+  assert(tensor->strides[0] == 1 && tensor->strides[1] == 3 &&
+         tensor->strides[2] == 12);
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    tensor->data[i] = (tensor_dtype)((i * 7) % 11);
+  }
+  for (size_t axis = 0; axis < 3; axis++) {
+    Tensor* sum = tensor_sum(tensor, axis);
+    Tensor* mean = tensor_mean(tensor, axis);
+    Tensor* max = tensor_max(tensor, axis);
+    Tensor* min = tensor_min(tensor, axis);
+    assert(sum != NULL && mean != NULL && max != NULL && min != NULL);
+    assert(sum->num_dims == 2 && sum->num_elements == 60 / shape[axis]);
+    size_t indices[3];
+    for (indices[2] = 0; indices[2] < 5; indices[2]++) {
+      for (indices[1] = 0; indices[1] < 4; indices[1]++) {
+        for (indices[0] = 0; indices[0] < 3; indices[0]++) {
+          if (indices[axis] != 0) {
+            continue;
+          }
+          tensor_dtype expected_sum = 0;
+          tensor_dtype expected_max = -INFINITY;
+          tensor_dtype expected_min = INFINITY;
+          size_t at[3] = { indices[0], indices[1], indices[2] };
+          for (at[axis] = 0; at[axis] < shape[axis]; at[axis]++) {
+            tensor_dtype value = tensor_get_value(tensor, at);
+            expected_sum += value;
+            expected_max = fmax(expected_max, value);
+            expected_min = fmin(expected_min, value);
+          }
+          size_t out[2];
+          for (size_t i = 0, j = 0; i < 3; i++) {
+            if (i != axis) {
+              out[j++] = indices[i];
+            }
+          }
+          assert(tensor_get_value(sum, out) == expected_sum);
+          assert(tensor_get_value(mean, out) == expected_sum / shape[axis]);
+          assert(tensor_get_value(max, out) == expected_max);
+          assert(tensor_get_value(min, out) == expected_min);
+        }
+      }
+    }
+    tensor_free(sum);
+    tensor_free(mean);
+    tensor_free(max);
+    tensor_free(min);
+  }
+  tensor_free(tensor);
+
+  // Mode keeps the value of the longest run along the axis
+  size_t mode_shape[2] = { 2, 5 };
+  Tensor* runs = tensor_create(mode_shape, 2);
+  tensor_dtype values[10] = { 1, 4, 2, 4, 2, 5, 2, 5, 3, 5 };
+  for (size_t i = 0; i < 10; i++) {
+    runs->data[i] = values[i];
+  }
+  Tensor* mode = tensor_mode(runs, 1);
+  assert(mode != NULL && mode->num_elements == 2);
+  assert(mode->data[0] == 2 && mode->data[1] == 5);
+  tensor_free(mode);
+  tensor_free(runs);
+}
+
+// Check a scan against a serial scan along each line of an axis
+void
+test_scan_check(const Tensor* tensor, size_t axis, const Tensor* result, int op)
+{
+  assert(result != NULL && tensor_same_shape(tensor, result));
+  size_t inner = tensor->strides[axis];
+  size_t length = tensor->shape[axis];
+  for (size_t base = 0; base < tensor->num_elements; base++) {
+    if (base / inner % length != 0) {
+      continue;
+    }
+    tensor_dtype acc = tensor->data[base];
+    for (size_t t = 0; t < length; t++) {
+      tensor_dtype value = tensor->data[base + t * inner];
+      if (t > 0) {
+        acc = op == 0   ? acc + value
+              : op == 1 ? acc * value
+              : op == 2 ? fmax(acc, value)
+                        : fmin(acc, value);
+      }
+      assert(result->data[base + t * inner] == acc);
+    }
+  }
+}
+
+// Test scans along contiguous and strided axes
+void
+test_tensor_scans()
+{
+  // Cover multi-chunk lines, partial column blocks and short axes
+  size_t shapes[3][3] = { { 20000, 3, 1 }, { 300, 100, 2 }, { 5, 2, 7 } };
+  for (size_t s = 0; s < 3; s++) {
+    Tensor* tensor = tensor_create(shapes[s], 3);
+    for (size_t i = 0; i < tensor->num_elements; i++) {
+      tensor->data[i] = (tensor_dtype)((i * 7919) % 13) - 6;
+    }
+    Tensor* signs = tensor_create(shapes[s], 3);
+    for (size_t i = 0; i < signs->num_elements; i++) {
+      signs->data[i] = i % 3 == 0 ? -1 : 1;
+    }
+    for (size_t axis = 0; axis < 3; axis++) {
+      Tensor* results[4] = { tensor_cumsum(tensor, axis),
+                             tensor_cumprod(signs, axis),
+                             tensor_cummax(tensor, axis),
+                             tensor_cummin(tensor, axis) };
+      for (int op = 0; op < 4; op++) {
+        test_scan_check(op == 1 ? signs : tensor, axis, results[op], op);
+        tensor_free(results[op]);
+      }
+    }
+    assert(tensor_cumsum(tensor, 3) == NULL);
+    tensor_free(tensor);
+    tensor_free(signs);
+  }
+}
+
+// Test index selection, gather, scatter-add and embedding bags
+void
+test_tensor_index()
+{
+  size_t shape[3] = { 3, 5, 4 };
+  Tensor* tensor = tensor_create(shape, 3);
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    tensor->data[i] = (tensor_dtype)i;
+  }
+
+  // Select slices with repeats along the middle axis
+  size_t indices[6] = { 4, 0, 0, 2, 1, 4 };
+  Tensor* select = tensor_index_select(tensor, 1, indices, 6);
+  assert(select->shape[1] == 6);
+  for (size_t o = 0; o < 4; o++) {
+    for (size_t k = 0; k < 6; k++) {
+      for (size_t i = 0; i < 3; i++) {
+        assert(select->data[i + 3 * k + 18 * o] ==
+               tensor->data[i + 3 * indices[k] + 15 * o]);
+      }
+    }
+  }
+  tensor_free(select);
+  indices[2] = 5;
+  assert(tensor_index_select(tensor, 1, indices, 6) == NULL);
+  assert(tensor_index_select(tensor, 3, indices, 6) == NULL);
+
+  // Gather and scatter-add along the middle axis with duplicates
+  size_t index_shape[3] = { 3, 7, 4 };
+  Tensor* index = tensor_create(index_shape, 3);
+  Tensor* source = tensor_create(index_shape, 3);
+  for (size_t i = 0; i < index->num_elements; i++) {
+    index->data[i] = (tensor_dtype)((i * 7) % 5);
+    source->data[i] = (tensor_dtype)(i % 11) - 5;
+  }
+  Tensor* gather = tensor_gather(tensor, 1, index);
+  Tensor* scatter = tensor_clone(tensor);
+  Tensor* expected = tensor_clone(tensor);
+  assert(tensor_make_writable(expected) == 0);
+  assert(tensor_scatter_add(scatter, 1, index, source) == 0);
+  for (size_t o = 0; o < 4; o++) {
+    for (size_t k = 0; k < 7; k++) {
+      for (size_t i = 0; i < 3; i++) {
+        size_t j = i + 3 * k + 21 * o;
+        size_t target = i + 3 * (size_t)index->data[j] + 15 * o;
+        assert(gather->data[j] == tensor->data[target]);
+        expected->data[target] += source->data[j];
+      }
+    }
+  }
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    assert(scatter->data[i] == expected->data[i]);
+  }
+  index->data[5] = 1.5;
+  assert(tensor_gather(tensor, 1, index) == NULL);
+  assert(tensor_scatter_add(scatter, 1, index, source) == -1);
+  assert(tensor_scatter_add(scatter, 0, index, source) == -1);
+  tensor_free(gather);
+  tensor_free(scatter);
+  tensor_free(expected);
+  tensor_free(index);
+  tensor_free(source);
+
+  // Scatter a long vector into a short one through private accumulators
+  size_t long_shape[1] = { 100000 };
+  size_t short_shape[1] = { 10 };
+  index = tensor_create(long_shape, 1);
+  source = tensor_create(long_shape, 1);
+  scatter = tensor_zeros(short_shape, 1);
+  tensor_dtype sums[10] = { 0 };
+  for (size_t i = 0; i < index->num_elements; i++) {
+    index->data[i] = (tensor_dtype)((i * 31) % 10);
+    source->data[i] = (tensor_dtype)(i % 3);
+    sums[(i * 31) % 10] += source->data[i];
+  }
+  assert(tensor_scatter_add(scatter, 0, index, source) == 0);
+  for (size_t i = 0; i < 10; i++) {
+    assert(scatter->data[i] == sums[i]);
+  }
+  tensor_free(index);
+  tensor_free(source);
+  tensor_free(scatter);
+  tensor_free(tensor);
+
+  // Reduce bags of embedding columns, including an empty bag
+  size_t weight_shape[2] = { 4, 6 };
+  Tensor* weight = tensor_create(weight_shape, 2);
+  for (size_t i = 0; i < weight->num_elements; i++) {
+    weight->data[i] = (tensor_dtype)((i * 5) % 9) - 4;
+  }
+  size_t lookups[7] = { 1, 5, 5, 0, 3, 2, 4 };
+  size_t offsets[4] = { 0, 3, 3, 4 };
+  for (int mode = 0; mode < 3; mode++) {
+    Tensor* bags =
+      tensor_embedding_bag(weight, lookups, 7, offsets, 4, mode);
+    assert(bags->shape[0] == 4 && bags->shape[1] == 4);
+    for (size_t b = 0; b < 4; b++) {
+      size_t last = b + 1 < 4 ? offsets[b + 1] : 7;
+      for (size_t i = 0; i < 4; i++) {
+        tensor_dtype value = 0;
+        for (size_t j = offsets[b]; j < last; j++) {
+          tensor_dtype element = weight->data[i + 4 * lookups[j]];
+          if (mode == TENSOR_EMBEDDING_MAX) {
+            value = j == offsets[b] ? element : fmax(value, element);
+          } else {
+            value += element;
+          }
+        }
+        if (mode == TENSOR_EMBEDDING_MEAN && last > offsets[b]) {
+          value /= (tensor_dtype)(last - offsets[b]);
+        }
+        assert(fabs(bags->data[i + 4 * b] - value) < 1e-12);
+      }
+    }
+    tensor_free(bags);
+  }
+  offsets[2] = 2;
+  assert(tensor_embedding_bag(weight, lookups, 7, offsets, 4, 0) == NULL);
+  lookups[0] = 6;
+  offsets[2] = 3;
+  assert(tensor_embedding_bag(weight, lookups, 7, offsets, 4, 0) == NULL);
+  tensor_free(weight);
+}
+
+// Test compressed tensors against their uncompressed originals
+void
+test_tensor_compress()
+{
+  // Mix zero runs, repeated exponents and a partial last block
+  size_t shape[3] = { 300, 50, 7 };
+  Tensor* tensor = tensor_zeros(shape, 3);
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    if (i % 5 != 0) {
+      tensor->data[i] = (tensor_dtype)((i * 7919) % 64) * 0.125;
+    }
+  }
+  TensorCompressed* compressed = tensor_compress(tensor);
+  size_t raw = tensor->num_elements * sizeof(tensor_dtype);
+  assert(tensor_compressed_num_blocks(compressed) == 26);
+  assert(tensor_compressed_num_elements(compressed) == 105000);
+  assert(tensor_compressed_size(compressed) < raw / 4);
+
+  // Decode whole, block by block, and after a round trip through a file
+  Tensor* result = tensor_decompress(compressed);
+  assert(memcmp(result->data, tensor->data, raw) == 0);
+  tensor_free(result);
+  tensor_dtype scratch[TENSOR_COMPRESS_BLOCK];
+  assert(tensor_compressed_block(compressed, 25, scratch) == 2600);
+  assert(memcmp(scratch,
+                tensor->data + 25 * TENSOR_COMPRESS_BLOCK,
+                2600 * sizeof(tensor_dtype)) == 0);
+  assert(tensor_compressed_block(compressed, 26, scratch) == 0);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_tensor_compress_%d", (int)getpid());
+  assert(tensor_compressed_save(compressed, path) == 0);
+  TensorCompressed* loaded = tensor_compressed_load(path);
+  assert(tensor_compressed_num_dims(loaded) == 3);
+  assert(tensor_compressed_shape(loaded)[1] == 50);
+  result = tensor_decompress(loaded);
+  assert(memcmp(result->data, tensor->data, raw) == 0);
+  tensor_free(result);
+  tensor_compressed_free(loaded);
+
+  // Streaming sums match the sums of the original tensor exactly
+  for (size_t axis = 0; axis < 3; axis++) {
+    Tensor* sum = tensor_compressed_sum(compressed, axis);
+    Tensor* expected = tensor_sum(tensor, axis);
+    assert(tensor_same_shape(sum, expected));
+    assert(memcmp(sum->data,
+                  expected->data,
+                  sum->num_elements * sizeof(tensor_dtype)) == 0);
+    tensor_free(sum);
+    tensor_free(expected);
+  }
+  assert(tensor_compressed_sum(compressed, 3) == NULL);
+  tensor_compressed_free(compressed);
+  tensor_free(tensor);
+
+  // Incompressible values are stored without growing
+  TensorGenerator generator;
+  tensor_generator_init(&generator, 7);
+  tensor = tensor_random_normal(&generator, shape, 2, 0, 1);
+  compressed = tensor_compress(tensor);
+  raw = tensor->num_elements * sizeof(tensor_dtype);
+  assert(tensor_compressed_size(compressed) <= raw);
+  result = tensor_decompress(compressed);
+  assert(memcmp(result->data, tensor->data, raw) == 0);
+  tensor_free(result);
+  tensor_free(tensor);
+
+  // Truncated files are rejected
+  assert(tensor_compressed_save(compressed, path) == 0);
+  assert(truncate(path, 100) == 0);
+  assert(tensor_compressed_load(path) == NULL);
+  unlink(path);
+  tensor_compressed_free(compressed);
+}
+
+// Test compiled plans against the eager operations
+void
+test_tensor_plan()
+{
+  size_t x_shape[2] = { 6, 4 };
+  size_t w1_shape[2] = { 4, 8 };
+  size_t b1_shape[1] = { 8 };
+  size_t w2_shape[2] = { 8, 8 };
+  TensorPlan* plan = tensor_plan_create();
+  size_t x = tensor_plan_input(plan, x_shape, 2);
+  size_t w1 = tensor_plan_input(plan, w1_shape, 2);
+  size_t b1 = tensor_plan_input(plan, b1_shape, 1);
+  size_t w2 = tensor_plan_input(plan, w2_shape, 2);
+
+  // The first intermediate is dead by the third, which reuses its memory
+  size_t h = tensor_plan_linear(plan, x, w1, b1, TENSOR_ACTIVATION_RELU);
+  size_t y = tensor_plan_matmul(plan, h, w2);
+  size_t z = tensor_plan_activation(plan, y, TENSOR_ACTIVATION_TANH);
+  size_t u = tensor_plan_scalar_multiply(plan, z, 0.5);
+  size_t v = tensor_plan_binary(plan, TENSOR_PLAN_SUBTRACT, u, y);
+  size_t sum = tensor_plan_reduce(plan, TENSOR_PLAN_SUM, v, 0);
+  size_t max = tensor_plan_reduce(plan, TENSOR_PLAN_MAX, v, 1);
+  assert(tensor_plan_matmul(plan, x, x) == TENSOR_PLAN_INVALID);
+  assert(tensor_plan_reduce(plan, TENSOR_PLAN_MEAN, v, 2) ==
+         TENSOR_PLAN_INVALID);
+  assert(tensor_plan_output(plan, v) == 0);
+  assert(tensor_plan_output(plan, sum) == 0);
+  assert(tensor_plan_output(plan, max) == 0);
+  assert(tensor_plan_output(plan, x) == -1);
+  assert(tensor_plan_compile(plan) == 0);
+  assert(tensor_plan_arena_size(plan) == 3 * 48 * sizeof(tensor_dtype));
+
+  Tensor* inputs[4] = { tensor_create(x_shape, 2),
+                        tensor_create(w1_shape, 2),
+                        tensor_create(b1_shape, 1),
+                        tensor_create(w2_shape, 2) };
+  Tensor* kept = NULL;
+  for (size_t run = 0; run < 3; run++) {
+    for (size_t i = 0; i < 4; i++) {
+      for (size_t j = 0; j < inputs[i]->num_elements; j++) {
+        inputs[i]->data[j] = (tensor_dtype)((j * 7 + i + run) % 11) * 0.1 - 0.4;
+      }
+    }
+
+    // Outputs are reused in place unless the caller kept a clone of one
+    const tensor_dtype* previous =
+      run > 0 ? tensor_plan_result(plan, 0)->data : NULL;
+    assert(tensor_plan_run(plan, (const Tensor* const*)inputs) == 0);
+    if (run == 1) {
+      assert(tensor_plan_result(plan, 0)->data == previous);
+      kept = tensor_clone(tensor_plan_result(plan, 0));
+    } else if (run == 2) {
+      assert(tensor_plan_result(plan, 0)->data != previous);
+      assert(kept->data == previous);
+    }
+
+    // Compute the same sequence eagerly
+    Tensor* eh =
+      tensor_linear(inputs[0], inputs[1], inputs[2], TENSOR_ACTIVATION_RELU);
+    Tensor* ey = tensor_matmul(eh, inputs[3]);
+    Tensor* ez = tensor_tanh(ey);
+    Tensor* eu = tensor_scalar_multiply(ez, 0.5);
+    Tensor* ev = tensor_subtract(eu, ey);
+    Tensor* esum = tensor_sum(ev, 0);
+    Tensor* emax = tensor_max(ev, 1);
+    assert(tensor_equal(tensor_plan_result(plan, 0), ev));
+    assert(tensor_equal(tensor_plan_result(plan, 1), esum));
+    assert(tensor_equal(tensor_plan_result(plan, 2), emax));
+    tensor_free(eh);
+    tensor_free(ey);
+    tensor_free(ez);
+    tensor_free(eu);
+    tensor_free(ev);
+    tensor_free(esum);
+    tensor_free(emax);
+  }
+  assert(!tensor_equal(tensor_plan_result(plan, 0), kept));
+  tensor_free(kept);
+  assert(tensor_plan_result(plan, 3) == NULL);
+
+  for (size_t i = 0; i < 4; i++) {
+    tensor_free(inputs[i]);
+  }
+  tensor_plan_free(plan);
+}
+
+// Test small tensors and the fixed-size kernels
+void
+test_tensor_small()
+{
+  TensorSmall small1, small2, small3;
+  size_t shape[2] = { 3, 3 };
+  Tensor* tensor1 = tensor_small_init(&small1, shape, 2);
+  Tensor* tensor2 = tensor_small_init(&small2, shape, 2);
+  Tensor* result = tensor_small_init(&small3, shape, 2);
+  assert(tensor1 != NULL && tensor1->num_elements == 9);
+  assert(tensor1->strides[1] == 3);
+  for (size_t i = 0; i < 9; i++) {
+    tensor1->data[i] = (tensor_dtype)i;
+    tensor2->data[i] = (tensor_dtype)(9 - i);
+  }
+
+  // Small results must match the heap path
+  Tensor* expected = tensor_matmul(tensor1, tensor2);
+  assert(tensor_matmul_into(tensor1, tensor2, result) == result);
+  assert(tensor_equal(result, expected));
+  tensor_free(expected);
+  expected = tensor_add(tensor1, tensor2);
+  assert(tensor_add_into(tensor1, tensor2, result) == result);
+  assert(tensor_equal(result, expected));
+  tensor_free(expected);
+  assert(tensor_transpose_into(tensor1, result) == result);
+  for (size_t i = 0; i < 3; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      assert(tensor_get_value(result, (size_t[]){ j, i }) ==
+             tensor_get_value(tensor1, (size_t[]){ i, j }));
+    }
+  }
+
+  // Matrix-vector products take the specialized path too
+  TensorSmall small4, small5;
+  size_t vector_shape[2] = { 3, 1 };
+  Tensor* vector = tensor_small_init(&small4, vector_shape, 2);
+  Tensor* product = tensor_small_init(&small5, vector_shape, 2);
+  for (size_t i = 0; i < 3; i++) {
+    vector->data[i] = (tensor_dtype)(i + 1);
+  }
+  assert(tensor_matmul_into(tensor1, vector, product) == product);
+  assert(product->data[0] == 24 && product->data[1] == 30 &&
+         product->data[2] == 36);
+
+  // Shapes that do not fit inline are rejected
+  size_t large_shape[2] = { 5, 5 };
+  assert(tensor_small_init(&small1, large_shape, 2) == NULL);
+}
+
+// Sum the inputs of a generic stream operation
+Tensor*
+test_stream_sum3(const Tensor* const* inputs, void* arg)
+{
+  Tensor* partial = tensor_add(inputs[0], inputs[1]);
+  Tensor* result = tensor_add(partial, inputs[2]);
+  tensor_free(partial);
+  *(int*)arg = 1;
+  return result;
+}
+
+// Test asynchronous streams and futures
+void
+test_tensor_stream()
+{
+  size_t shape[2] = { 16, 16 };
+  Tensor* tensor1 = tensor_create(shape, 2);
+  Tensor* tensor2 = tensor_create(shape, 2);
+  for (size_t i = 0; i < tensor1->num_elements; i++) {
+    tensor1->data[i] = (tensor_dtype)(i % 7);
+    tensor2->data[i] = (tensor_dtype)(i % 5);
+  }
+
+  // Independent work on two streams, joined through a shared future
+  TensorStream* stream1 = tensor_stream_create();
+  TensorStream* stream2 = tensor_stream_create();
+  TensorFuture* input1 = tensor_future_from_tensor(tensor1);
+  TensorFuture* input2 = tensor_future_from_tensor(tensor2);
+  TensorFuture* product =
+    tensor_stream_binary(stream1, tensor_matmul, input1, input2);
+  TensorFuture* scaled =
+    tensor_stream_scalar(stream2, tensor_scalar_multiply, input1, 2);
+  TensorFuture* sum = tensor_stream_axis(stream1, tensor_sum, product, 0);
+  int ran = 0;
+  TensorFuture* inputs[3] = { product, scaled, input2 };
+  TensorFuture* joined =
+    tensor_stream_enqueue(stream2, test_stream_sum3, inputs, 3, &ran);
+  TensorFuture* reversed =
+    tensor_stream_unary(stream2, tensor_transpose, sum);
+  TensorFuture* chained =
+    tensor_stream_binary(stream2, tensor_add, reversed, joined);
+  assert(product != NULL && scaled != NULL && sum != NULL && joined != NULL);
+
+  // Results match the synchronous API
+  Tensor* expected_product = tensor_matmul(tensor1, tensor2);
+  Tensor* expected_sum = tensor_sum(expected_product, 0);
+  Tensor* expected_scaled = tensor_scalar_multiply(tensor1, 2);
+  Tensor* partial = tensor_add(expected_product, expected_scaled);
+  Tensor* expected_joined = tensor_add(partial, tensor2);
+  assert(tensor_equal(tensor_future_wait(sum), expected_sum));
+  assert(tensor_equal(tensor_future_wait(joined), expected_joined));
+  assert(ran == 1);
+
+  // Failures propagate to dependent operations
+  tensor_stream_synchronize(stream2);
+  assert(tensor_future_ready(chained));
+  assert(tensor_future_wait(reversed) != NULL);
+  assert(tensor_future_wait(chained) == NULL);
+
+  tensor_future_release(input1);
+  tensor_future_release(input2);
+  tensor_future_release(product);
+  tensor_future_release(scaled);
+  tensor_future_release(sum);
+  tensor_future_release(joined);
+  tensor_future_release(reversed);
+  tensor_future_release(chained);
+  tensor_stream_free(stream1);
+  tensor_stream_free(stream2);
+  tensor_free(expected_product);
+  tensor_free(expected_sum);
+  tensor_free(expected_scaled);
+  tensor_free(partial);
+  tensor_free(expected_joined);
+  tensor_free(tensor1);
+  tensor_free(tensor2);
+}
+
+// Test shared copy-on-write storage
+void
+test_tensor_clone()
+{
+  size_t shape[2] = { 2, 3 };
+  Tensor* tensor = tensor_create(shape, 2);
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    tensor->data[i] = (tensor_dtype)i;
+  }
+
+  // Clones and views share data until written
+  Tensor* clone = tensor_clone(tensor);
+  size_t view_shape[1] = { 6 };
+  Tensor* view = tensor_reshape(tensor, view_shape, 1);
+  assert(clone != NULL && view != NULL);
+  assert(clone->data == tensor->data && view->data == tensor->data);
+  assert(view->num_dims == 1 && view->strides[0] == 1);
+  assert(tensor_reshape(tensor, (size_t[]){ 4 }, 1) == NULL);
+
+  // Writing detaches the writer only
+  assert(tensor_set_value(clone, (size_t[]){ 1, 2 }, 42) == 0);
+  assert(clone->data != tensor->data);
+  assert(tensor_get_value(clone, (size_t[]){ 1, 2 }) == 42);
+  assert(tensor_get_value(tensor, (size_t[]){ 1, 2 }) == 5);
+  assert(view->data == tensor->data);
+
+  // The original survives its views and clones being freed, and vice versa
+  tensor_free(tensor);
+  assert(view->data[5] == 5);
+  assert(tensor_make_writable(view) == 0);
+  view->data[5] = 7;
+  tensor_free(view);
+  tensor_free(clone);
+}
+
+// Test fill functions
+void
+test_tensor_fill()
+{
+  size_t shape[2] = { 3, 5 };
+  Tensor* zeros = tensor_zeros(shape, 2);
+  Tensor* full = tensor_full(shape, 2, 2.5);
+  assert(zeros != NULL && full != NULL);
+  for (size_t i = 0; i < 15; i++) {
+    assert(zeros->data[i] == 0 && full->data[i] == 2.5);
+  }
+
+  Tensor* negative_zeros = tensor_full(shape, 2, -0.0);
+  assert(signbit(negative_zeros->data[14]));
+  tensor_free(negative_zeros);
+
+  // Filling a shared tensor leaves the other owner untouched
+  Tensor* clone = tensor_clone(full);
+  assert(tensor_fill(clone, -1) == 0);
+  assert(clone->data[14] == -1 && full->data[14] == 2.5);
+
+  Tensor* range = tensor_arange(1, 2, 0.25);
+  assert(range != NULL && range->num_dims == 1 && range->shape[0] == 4);
+  assert(range->data[0] == 1 && range->data[3] == 1.75);
+  Tensor* empty = tensor_arange(1, 0, 1);
+  assert(empty != NULL && empty->num_elements == 0);
+  assert(tensor_arange(0, 1, 0) == NULL);
+  assert(tensor_arange(0, INFINITY, 1) == NULL);
+  assert(tensor_arange(-1e300, 1e300, 1e-300) == NULL);
+
+  tensor_free(zeros);
+  tensor_free(full);
+  tensor_free(clone);
+  tensor_free(range);
+  tensor_free(empty);
+}
+
+// Test counter-based random number generation
+void
+test_tensor_random()
+{
+  // Known-answer test for Philox4x32-10
+  uint32_t counter[4] = { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 };
+  uint32_t key[2] = { 0xa4093822, 0x299f31d0 };
+  uint32_t words[4];
+  tensor_philox(counter, key, words);
+  assert(words[0] == 0xd16cfe09 && words[1] == 0x94fdcceb &&
+         words[2] == 0x5001e420 && words[3] == 0x24126ea1);
+
+  // Same seed reproduces the same stream, and each call advances it
+  TensorGenerator generator1, generator2;
+  tensor_generator_init(&generator1, 1234);
+  tensor_generator_init(&generator2, 1234);
+  size_t shape[2] = { 101, 99 };
+  Tensor* uniform1 = tensor_random_uniform(&generator1, shape, 2, -1, 3);
+  Tensor* uniform2 = tensor_random_uniform(&generator2, shape, 2, -1, 3);
+  Tensor* uniform3 = tensor_random_uniform(&generator2, shape, 2, -1, 3);
+  assert(tensor_equal(uniform1, uniform2));
+  assert(!tensor_equal(uniform2, uniform3));
+  tensor_dtype sum = 0;
+  for (size_t i = 0; i < uniform1->num_elements; i++) {
+    assert(uniform1->data[i] >= -1 && uniform1->data[i] < 3);
+    sum += uniform1->data[i];
+  }
+  assert(fabs(sum / uniform1->num_elements - 1) < 0.05);
+
+  // Sample moments of the other distributions
+  Tensor* normal = tensor_random_normal(&generator1, shape, 2, 2, 0.5);
+  tensor_dtype mean = 0, variance = 0;
+  for (size_t i = 0; i < normal->num_elements; i++) {
+    mean += normal->data[i];
+  }
+  mean /= normal->num_elements;
+  for (size_t i = 0; i < normal->num_elements; i++) {
+    variance += (normal->data[i] - mean) * (normal->data[i] - mean);
+  }
+  variance /= normal->num_elements;
+  assert(fabs(mean - 2) < 0.02 && fabs(variance - 0.25) < 0.02);
+  Tensor* mask = tensor_random_bernoulli(&generator1, shape, 2, 0.3);
+  sum = 0;
+  for (size_t i = 0; i < mask->num_elements; i++) {
+    assert(mask->data[i] == 0 || mask->data[i] == 1);
+    sum += mask->data[i];
+  }
+  assert(fabs(sum / mask->num_elements - 0.3) < 0.02);
+  assert(tensor_random_bernoulli(&generator1, shape, 2, 1.5) == NULL);
+
+  tensor_free(uniform1);
+  tensor_free(uniform2);
+  tensor_free(uniform3);
+  tensor_free(normal);
+  tensor_free(mask);
+}
+
+// Create a tensor with deterministic non-trivial values
+Tensor*
+test_tensor_iota(const size_t* shape, size_t num_dims, tensor_dtype scale)
+{
+  Tensor* tensor = tensor_create(shape, num_dims);
+  for (size_t i = 0; i < tensor->num_elements; i++) {
+    tensor->data[i] = scale * (tensor_dtype)((i * 7 + 3) % 13) - 6;
+  }
+  return tensor;
+}
+
+// Test tensor_einsum function
+void
+test_tensor_einsum()
+{
+  Tensor* a = test_tensor_iota((size_t[]){ 3, 4 }, 2, 1);
+  Tensor* b = test_tensor_iota((size_t[]){ 4, 5 }, 2, 0.5);
+  Tensor* c = test_tensor_iota((size_t[]){ 5, 2 }, 2, 2);
+  Tensor* v = test_tensor_iota((size_t[]){ 3 }, 1, 1);
+  Tensor* w = test_tensor_iota((size_t[]){ 4 }, 1, 1);
+  Tensor* square = test_tensor_iota((size_t[]){ 4, 4 }, 2, 1);
+
+  // Matrix product, explicit and implicit, matches tensor_matmul
+  Tensor* expected = tensor_matmul(a, b);
+  Tensor* result = tensor_einsum("ij,jk->ik", (const Tensor*[]){ a, b }, 2);
+  assert(result != NULL && tensor_equal(result, expected));
+  tensor_free(result);
+  result = tensor_einsum("ij,jk", (const Tensor*[]){ a, b }, 2);
+  assert(result != NULL && tensor_equal(result, expected));
+  tensor_free(result);
+
+  // Chained product, planned once and then served from the cache
+  Tensor* chain = tensor_matmul(expected, c);
+  for (int repeat = 0; repeat < 2; repeat++) {
+    result =
+      tensor_einsum("ij,jk,kl->il", (const Tensor*[]){ a, b, c }, 3);
+    assert(result != NULL && result->shape[0] == 3 && result->shape[1] == 2);
+    for (size_t i = 0; i < result->num_elements; i++) {
+      assert(fabs(result->data[i] - chain->data[i]) < 1e-9);
+    }
+    tensor_free(result);
+  }
+  tensor_free(chain);
+
+  // Bilinear form v^T A w reduces to a scalar
+  tensor_dtype bilinear = 0;
+  for (size_t i = 0; i < 3; i++) {
+    for (size_t j = 0; j < 4; j++) {
+      bilinear += v->data[i] * tensor_get_value(a, (size_t[]){ i, j }) *
+                  w->data[j];
+    }
+  }
+  result = tensor_einsum("i,ij,j->", (const Tensor*[]){ v, a, w }, 3);
+  assert(result != NULL && result->num_dims == 0);
+  assert(fabs(result->data[0] - bilinear) < 1e-9);
+  tensor_free(result);
+
+  // Batched outer product keeps the shared letter as a batch axis
+  Tensor* x = test_tensor_iota((size_t[]){ 2, 3 }, 2, 1);
+  Tensor* y = test_tensor_iota((size_t[]){ 2, 4 }, 2, 1);
+  result = tensor_einsum("bi,bj->bij", (const Tensor*[]){ x, y }, 2);
+  assert(result != NULL && result->num_dims == 3);
+  for (size_t bi = 0; bi < 2; bi++) {
+    for (size_t i = 0; i < 3; i++) {
+      for (size_t j = 0; j < 4; j++) {
+        assert(tensor_get_value(result, (size_t[]){ bi, i, j }) ==
+               tensor_get_value(x, (size_t[]){ bi, i }) *
+                 tensor_get_value(y, (size_t[]){ bi, j }));
+      }
+    }
+  }
+  tensor_free(result);
+
+  // Single operand: trace, diagonal, transpose and row sums
+  tensor_dtype trace = 0;
+  for (size_t i = 0; i < 4; i++) {
+    trace += tensor_get_value(square, (size_t[]){ i, i });
+  }
+  result = tensor_einsum("ii->", (const Tensor*[]){ square }, 1);
+  assert(result != NULL && result->data[0] == trace);
+  tensor_free(result);
+  result = tensor_einsum("ii->i", (const Tensor*[]){ square }, 1);
+  assert(result != NULL && result->data[2] == square->data[10]);
+  tensor_free(result);
+  Tensor* transposed = tensor_transpose(a);
+  result = tensor_einsum("ij->ji", (const Tensor*[]){ a }, 1);
+  assert(result != NULL && tensor_equal(result, transposed));
+  tensor_free(result);
+  tensor_free(transposed);
+  Tensor* sums = tensor_sum(a, 1);
+  result = tensor_einsum("ij->i", (const Tensor*[]){ a }, 1);
+  assert(result != NULL && tensor_equal(result, sums));
+  tensor_free(result);
+  tensor_free(sums);
+
+  // Mismatched specs are rejected
+  assert(tensor_einsum("ij,jk->ik", (const Tensor*[]){ a, c }, 2) == NULL);
+  assert(tensor_einsum("ij,jk->iq", (const Tensor*[]){ a, b }, 2) == NULL);
+  assert(tensor_einsum("ijk,jk->ik", (const Tensor*[]){ a, b }, 2) == NULL);
+  tensor_einsum_clear_cache();
+
+  tensor_free(expected);
+  tensor_free(a);
+  tensor_free(b);
+  tensor_free(c);
+  tensor_free(v);
+  tensor_free(w);
+  tensor_free(x);
+  tensor_free(y);
+  tensor_free(square);
+}
+
+// Run collectives as one rank of a communicator
+void
+test_collective_rank(const char* name,
+                     uint64_t session,
+                     size_t rank,
+                     size_t world_size)
+{
+  // A small capacity forces several rounds of several chunks each
+  TensorCommunicator* comm =
+    tensor_comm_create(name, session, rank, world_size, 3 * 10000);
+  assert(comm != NULL && tensor_comm_rank(comm) == rank);
+
+  size_t n = 50000;
+  Tensor* tensor = tensor_create(&n, 1);
+  for (size_t i = 0; i < n; i++) {
+    tensor->data[i] = (tensor_dtype)(rank * 100000 + i);
+  }
+  Tensor* input = tensor_clone(tensor);
+  assert(tensor_allreduce(comm, tensor) == 0);
+  for (size_t i = 0; i < n; i++) {
+    assert(tensor->data[i] == (tensor_dtype)(300000 + 3 * i));
+  }
+  for (size_t i = 0; i < n; i++) {
+    tensor->data[i] = (tensor_dtype)(rank * 100000 + i);
+  }
+  assert(tensor_broadcast(comm, tensor, 1) == 0);
+  assert(tensor->data[7] == 100007 && tensor->data[n - 1] == 100000 + n - 1);
+
+  size_t part_size = n / world_size + 1;
+  size_t total = part_size * world_size;
+  Tensor* scattered = tensor_create(&part_size, 1);
+  Tensor* gathered = tensor_create(&total, 1);
+  Tensor* source = tensor_create(&total, 1);
+  for (size_t i = 0; i < total; i++) {
+    source->data[i] = (tensor_dtype)(rank + i);
+  }
+  assert(tensor_reduce_scatter(comm, source, scattered) == 0);
+  for (size_t i = 0; i < part_size; i++) {
+    assert(scattered->data[i] == 3 + 3 * (rank * part_size + i));
+  }
+  assert(tensor_allgather(comm, scattered, gathered) == 0);
+  for (size_t i = 0; i < total; i++) {
+    assert(gathered->data[i] == 3 + 3 * i);
+  }
+  assert(tensor_allgather(comm, input, source) == -1);
+
+  // The clone taken before the allreduce still holds the local values
+  assert(input->data[1] == (tensor_dtype)(rank * 100000 + 1));
+
+  tensor_free(tensor);
+  tensor_free(input);
+  tensor_free(scattered);
+  tensor_free(gathered);
+  tensor_free(source);
+  tensor_comm_free(comm);
+}
+
+// Test shared memory collectives across forked processes
+void
+test_tensor_collective()
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/tensor_test_%d", (int)getpid());
+  size_t world_size = 3;
+  pid_t children[2];
+
+  // Leave a stale segment behind, as a job that crashed during setup would
+  pid_t stale = fork();
+  assert(stale >= 0);
+  if (stale == 0) {
+    tensor_comm_create(name, 1, 0, world_size, 3 * 10000);
+    _exit(1);
+  }
+  usleep(100000);
+  kill(stale, SIGKILL);
+  assert(waitpid(stale, NULL, 0) == stale);
+
+  uint64_t session = (uint64_t)getpid() << 1;
+  for (size_t rank = 1; rank < world_size; rank++) {
+    children[rank - 1] = fork();
+    assert(children[rank - 1] >= 0);
+    if (children[rank - 1] == 0) {
+      test_collective_rank(name, session, rank, world_size);
+      _exit(0);
+    }
+  }
+  test_collective_rank(name, session, 0, world_size);
+  for (size_t rank = 1; rank < world_size; rank++) {
+    int status;
+    assert(waitpid(children[rank - 1], &status, 0) == children[rank - 1]);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+}
+
 // Test suite entry point
 int
 main()
 {
+  // Keep GEMM blocking independent of any tuning file on this machine
+  setenv(TENSOR_TUNING_FILE_ENV, "/nonexistent/tensor_gemm.tune", 1);
+
   test_tensor_create();
+  test_tensor_matmul();
+  test_tensor_autotune();
+  test_tensor_linear();
+  test_tensor_transpose();
+  test_tensor_reductions();
+  test_tensor_scans();
+  test_tensor_index();
+  test_tensor_small();
+  test_tensor_stream();
+  test_tensor_clone();
+  test_tensor_fill();
+  test_tensor_random();
+  test_tensor_einsum();
+  test_tensor_plan();
+  test_tensor_compress();
+  test_tensor_collective();
   printf("All tests passed!\n");
   return 0;
 }
\ No newline at end of file